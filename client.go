@@ -0,0 +1,57 @@
+package main
+
+import (
+	"encoding/json"
+	"errors"
+	"fmt"
+	"net"
+	"os"
+	"slices"
+)
+
+// dialServer connects to a running server. Without an explicit socket, the
+// default one is tried, and nil is returned if no server is listening there.
+func dialServer() (net.Conn, error) {
+	if *socket != "" {
+		return net.Dial("unix", *socket)
+	}
+
+	conn, err := net.Dial("unix", defaultSocket())
+	if err != nil {
+		return nil, nil
+	}
+	return conn, nil
+}
+
+func runClient(conn net.Conn, o *options) error {
+	defer conn.Close()
+
+	if slices.Contains(o.Args, "-") {
+		return errors.New("standard input is not supported by the server")
+	}
+	if err := o.absPaths(); err != nil {
+		return err
+	}
+
+	if err := json.NewEncoder(conn).Encode(o); err != nil {
+		return err
+	}
+
+	dec := json.NewDecoder(conn)
+	for {
+		var f frame
+		if err := dec.Decode(&f); err != nil {
+			return fmt.Errorf("server: %w", err)
+		}
+
+		os.Stdout.WriteString(f.Stdout)
+		os.Stderr.WriteString(f.Stderr)
+
+		if f.Done {
+			if f.Error != "" {
+				return errors.New(f.Error)
+			}
+			return nil
+		}
+	}
+}
@@ -0,0 +1,52 @@
+// SPDX-FileCopyrightText: 2025 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <stdint.h>
+
+#include <stm32f0xx.h>
+
+#include "crc.h"
+
+
+void
+crc_init(void)
+{
+    RCC->AHBENR |= RCC_AHBENR_CRCEN;
+
+    // standard CRC-32 (same as zlib), bit-reversed input (by byte) and output
+    CRC->CR = CRC_CR_REV_IN_0 | CRC_CR_REV_OUT;
+    crc_reset();
+}
+
+
+void
+crc_reset(void)
+{
+    CRC->INIT = 0xffffffff;
+    CRC->CR |= CRC_CR_RESET;
+}
+
+
+void
+crc_update(const uint8_t *buf, uint32_t len)
+{
+    uint32_t i = 0;
+
+    for (; i < len && (((uint32_t) (buf + i)) & 3) != 0; i++)
+        *((__IO uint8_t*) &CRC->DR) = buf[i];
+
+    // whole words once aligned, the unit consumes the most significant byte
+    // first, so bytes are swapped to keep the stream order.
+    for (; i + 4 <= len; i += 4)
+        CRC->DR = __REV(*((const uint32_t*) (buf + i)));
+
+    for (; i < len; i++)
+        *((__IO uint8_t*) &CRC->DR) = buf[i];
+}
+
+
+uint32_t
+crc_get(void)
+{
+    return CRC->DR ^ 0xffffffff;
+}
@@ -0,0 +1,11 @@
+// SPDX-FileCopyrightText: 2025 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <stdint.h>
+
+void crc_init(void);
+void crc_reset(void);
+void crc_update(const uint8_t *buf, uint32_t len);
+uint32_t crc_get(void);
@@ -19,11 +19,15 @@
 // +----------+--------+-------------------+
 // |        1 | Input  |               256 |
 // +----------+--------+-------------------+
-// |        1 | Output |               259 |
+// |        1 | Output |               260 |
 // +----------+--------+-------------------+
 // |        2 | Input  |                 4 |
 // +----------+--------+-------------------+
-// |        2 | Output |                 4 |
+// |        2 | Output |                 5 |
+// +----------+--------+-------------------+
+// |        3 | Input  |                 7 |
+// +----------+--------+-------------------+
+// |        4 | Output |                55 |
 // +----------+--------+-------------------+
 static const uint8_t hid_report_descriptor[] = {
     0x06, 0x00, 0xFF,    // UsagePage(iceflashprog[0xFF00])
@@ -49,10 +53,25 @@ static const uint8_t hid_report_descriptor[] = {
     0x95, 0x03,          //         ReportCount(3)
     0x81, 0x02,          //         Input(Data, Variable, Absolute, NoWrap, Linear, PreferredState, NoNullPosition, BitField)
     0xC0,                //     EndCollection()
+    0x85, 0x03,          //     ReportId(3)
+    0x09, 0x05,          //     UsageId(Event[0x0005])
+    0xA1, 0x02,          //     Collection(Logical)
+    0x09, 0x16,          //         UsageId(Event ID[0x0016])
+    0x95, 0x01,          //         ReportCount(1)
+    0x81, 0x02,          //         Input(Data, Variable, Absolute, NoWrap, Linear, PreferredState, NoNullPosition, BitField)
+    0x09, 0x13,          //         UsageId(Command ID[0x0013])
+    0x81, 0x02,          //         Input(Data, Variable, Absolute, NoWrap, Linear, PreferredState, NoNullPosition, BitField)
+    0x09, 0x15,          //         UsageId(Status[0x0015])
+    0x81, 0x02,          //         Input(Data, Variable, Absolute, NoWrap, Linear, PreferredState, NoNullPosition, BitField)
+    0x09, 0x17,          //         UsageId(Event Data[0x0017])
+    0x95, 0x04,          //         ReportCount(4)
+    0x81, 0x02,          //         Input(Data, Variable, Absolute, NoWrap, Linear, PreferredState, NoNullPosition, BitField)
+    0xC0,                //     EndCollection()
     0x85, 0x01,          //     ReportId(1)
     0x09, 0x02,          //     UsageId(Flash Page[0x0002])
     0xA1, 0x02,          //     Collection(Logical)
     0x09, 0x11,          //         UsageId(Address[0x0011])
+    0x95, 0x04,          //         ReportCount(4)
     0x91, 0x02,          //         Output(Data, Variable, Absolute, NoWrap, Linear, PreferredState, NoNullPosition, NonVolatile, BitField)
     0x09, 0x12,          //         UsageId(Data[0x0012])
     0x96, 0x00, 0x01,    //         ReportCount(256)
@@ -65,7 +84,17 @@ static const uint8_t hid_report_descriptor[] = {
     0x95, 0x01,          //         ReportCount(1)
     0x91, 0x02,          //         Output(Data, Variable, Absolute, NoWrap, Linear, PreferredState, NoNullPosition, NonVolatile, BitField)
     0x09, 0x12,          //         UsageId(Data[0x0012])
-    0x95, 0x03,          //         ReportCount(3)
+    0x95, 0x04,          //         ReportCount(4)
+    0x91, 0x02,          //         Output(Data, Variable, Absolute, NoWrap, Linear, PreferredState, NoNullPosition, NonVolatile, BitField)
+    0xC0,                //     EndCollection()
+    0x85, 0x04,          //     ReportId(4)
+    0x09, 0x06,          //     UsageId(Job[0x0006])
+    0xA1, 0x02,          //     Collection(Logical)
+    0x09, 0x18,          //         UsageId(Step Count[0x0018])
+    0x95, 0x01,          //         ReportCount(1)
+    0x91, 0x02,          //         Output(Data, Variable, Absolute, NoWrap, Linear, PreferredState, NoNullPosition, NonVolatile, BitField)
+    0x09, 0x19,          //         UsageId(Steps[0x0019])
+    0x95, 0x36,          //         ReportCount(54)
     0x91, 0x02,          //         Output(Data, Variable, Absolute, NoWrap, Linear, PreferredState, NoNullPosition, NonVolatile, BitField)
     0xC0,                //     EndCollection()
     0xC0,                // EndCollection()
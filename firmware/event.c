@@ -0,0 +1,92 @@
+// SPDX-FileCopyrightText: 2025 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <stm32f0xx.h>
+
+#include "event.h"
+#include "sched.h"
+
+// posted from interrupt handlers, consumed by the main loop. cortex-m0 has no
+// exclusive access instructions, so updates from the main loop run with
+// interrupts disabled.
+static volatile uint32_t events = 0;
+
+// when each event was posted, while pending. used by the scheduler for
+// deadlines.
+static volatile uint32_t posted_at[EVENT_COUNT];
+
+
+void
+event_post(event_t ev)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    uint32_t now = sched_now();
+    for (uint8_t i = 0; i < EVENT_COUNT; i++) {
+        if ((ev & (1 << i)) != 0 && (events & (1 << i)) == 0)
+            posted_at[i] = now;
+    }
+    events |= ev;
+    __set_PRIMASK(primask);
+}
+
+
+bool
+event_pending(event_t mask)
+{
+    return (events & mask) != 0;
+}
+
+
+uint32_t
+event_posted_at(event_t mask)
+{
+    uint32_t age = 0;
+
+    __disable_irq();
+    uint32_t now = sched_now();
+    for (uint8_t i = 0; i < EVENT_COUNT; i++) {
+        if ((mask & events & (1 << i)) != 0 && now - posted_at[i] > age)
+            age = now - posted_at[i];
+    }
+    __enable_irq();
+
+    return now - age;
+}
+
+
+bool
+event_take(event_t ev)
+{
+    if ((events & ev) == 0)
+        return false;
+
+    __disable_irq();
+    events &= ~ev;
+    __enable_irq();
+    return true;
+}
+
+
+void
+event_clear(event_t ev)
+{
+    __disable_irq();
+    events &= ~ev;
+    __enable_irq();
+}
+
+
+void
+event_wait(void)
+{
+    // an interrupt that fires after the check still wakes the core up, even
+    // with interrupts disabled, so no event is lost before sleeping.
+    __disable_irq();
+    if (events == 0)
+        __WFI();
+    __enable_irq();
+}
@@ -0,0 +1,23 @@
+// SPDX-FileCopyrightText: 2025 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum {
+    EVENT_SPI   = (1 << 0),  // SPI DMA transfer complete
+    EVENT_TIMER = (1 << 1),  // TIM3 update (flash status poll tick)
+    EVENT_USB   = (1 << 2),  // USB peripheral interrupt, masked until handled
+    EVENT_FLASH = (1 << 3),  // SPI flash sequence step staged
+} event_t;
+
+#define EVENT_COUNT 4
+
+void event_post(event_t ev);
+bool event_take(event_t ev);
+void event_clear(event_t ev);
+bool event_pending(event_t mask);
+uint32_t event_posted_at(event_t mask);
+void event_wait(void);
@@ -0,0 +1,259 @@
+// SPDX-FileCopyrightText: 2025 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "crc.h"
+#include "job.h"
+#include "spi_flash.h"
+#include "watchdog.h"
+
+#define SECTOR_SIZE 0x1000
+#define BLOCK_SIZE  0x10000
+#define CRC_CHUNK   0x10000  // keeps each flash sequence well within the watchdog period
+
+static job_step_t steps[JOB_MAX_STEPS];
+static uint8_t steps_len = 0;
+static uint8_t current = 0;
+static uint32_t offset = 0;
+static uint32_t done = 0;
+static bool running = false;
+static bool busy = false;
+
+static uint8_t *pending_page = NULL;
+
+
+static void
+finish(bool ok, uint32_t address)
+{
+    running = false;
+    busy = false;
+    steps_len = 0;
+    if (pending_page != NULL) {
+        pending_page = NULL;
+        job_page_consumed_cb();
+    }
+    job_complete_cb(ok, address);
+}
+
+
+static void
+program_page(void)
+{
+    if (busy || pending_page == NULL)
+        return;
+
+    job_step_t *s = &steps[current];
+    uint32_t address = (pending_page[1] << 24) | (pending_page[2] << 16) | (pending_page[3] << 8) | pending_page[4];
+    if (address != s->address + offset) {
+        finish(false, address);
+        return;
+    }
+
+    // the page buffer now belongs to the flash layer, that releases it once
+    // sent.
+    if (!spi_flash_write(pending_page, s->op == JOB_PROGRAM))
+        return;
+
+    busy = true;
+    pending_page = NULL;
+}
+
+
+static inline uint32_t
+crc_chunk(void)
+{
+    uint32_t remaining = steps[current].length - offset;
+    return remaining > CRC_CHUNK ? CRC_CHUNK : remaining;
+}
+
+
+static void
+step_start(void)
+{
+    if (current >= steps_len) {
+        finish(true, 0);
+        return;
+    }
+
+    job_step_t *s = &steps[current];
+    uint32_t address = s->address + offset;
+    bool ok = true;
+
+    if (offset == 0)
+        job_step_started_cb(current);
+
+    switch (s->op) {
+    case JOB_ERASE_SECTOR:
+        ok = spi_flash_erase_sector(address);
+        busy = true;
+        break;
+
+    case JOB_ERASE_BLOCK:
+        ok = spi_flash_erase_block(address);
+        busy = true;
+        break;
+
+    case JOB_PROGRAM:
+    case JOB_PROGRAM_NOVERIFY:
+        // pages are pushed by the host
+        program_page();
+        break;
+
+    case JOB_CRC:
+        if (offset == 0)
+            crc_reset();
+        ok = spi_flash_crc(address, crc_chunk());
+        busy = true;
+        break;
+    }
+
+    if (!ok)
+        finish(false, address);
+}
+
+
+static void
+step_advance(uint32_t len)
+{
+    // steps are chained without the flash ever being unlocked, so the
+    // watchdog is not reloaded on SOF while a job runs. each erase, page or
+    // CRC chunk completed is progress.
+    watchdog_reload();
+
+    busy = false;
+    offset += len;
+    done += len;
+
+    if (offset >= steps[current].length) {
+        current++;
+        offset = 0;
+    }
+    step_start();
+}
+
+
+bool
+job_push(job_op_t op, uint32_t address, uint32_t length)
+{
+    if (running || steps_len >= JOB_MAX_STEPS || length == 0)
+        return false;
+
+    switch (op) {
+    case JOB_ERASE_SECTOR:
+    case JOB_ERASE_BLOCK:
+    case JOB_PROGRAM:
+    case JOB_CRC:
+    case JOB_PROGRAM_NOVERIFY:
+        break;
+
+    default:
+        return false;
+    }
+
+    steps[steps_len].op = op;
+    steps[steps_len].address = address;
+    steps[steps_len].length = length;
+    steps_len++;
+    return true;
+}
+
+
+void
+job_clear(void)
+{
+    if (!running)
+        steps_len = 0;
+}
+
+
+bool
+job_run(void)
+{
+    if (running || steps_len == 0)
+        return false;
+
+    running = true;
+    busy = false;
+    current = 0;
+    offset = 0;
+    done = 0;
+    pending_page = NULL;
+    step_start();
+    return true;
+}
+
+
+bool
+job_is_running(void)
+{
+    return running;
+}
+
+
+uint32_t
+job_done(void)
+{
+    return done;
+}
+
+
+bool
+job_write_page(uint8_t *page)
+{
+    if (!running || pending_page != NULL)
+        return false;
+
+    pending_page = page;
+
+    if (steps[current].op == JOB_PROGRAM || steps[current].op == JOB_PROGRAM_NOVERIFY)
+        program_page();
+    return true;
+}
+
+
+void
+job_step_cb(bool ok)
+{
+    if (!running)
+        return;
+
+    job_step_t *s = &steps[current];
+    if (!ok) {
+        finish(false, s->address + offset);
+        return;
+    }
+
+    switch (s->op) {
+    case JOB_ERASE_SECTOR:
+        step_advance(SECTOR_SIZE - ((s->address + offset) & (SECTOR_SIZE - 1)));
+        break;
+
+    case JOB_ERASE_BLOCK:
+        step_advance(BLOCK_SIZE - ((s->address + offset) & (BLOCK_SIZE - 1)));
+        break;
+
+    case JOB_PROGRAM:
+    case JOB_PROGRAM_NOVERIFY:
+        step_advance(SPI_FLASH_PAGE_SIZE);
+        break;
+
+    case JOB_CRC:
+        break;
+    }
+}
+
+
+void
+job_crc_cb(uint32_t crc)
+{
+    if (!running)
+        return;
+
+    uint32_t chunk = crc_chunk();
+    if (offset + chunk >= steps[current].length)
+        job_result_cb(crc);
+    step_advance(chunk);
+}
@@ -0,0 +1,40 @@
+// SPDX-FileCopyrightText: 2025 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef JOB_MAX_STEPS
+#define JOB_MAX_STEPS 16
+#endif
+
+typedef enum {
+    JOB_ERASE_SECTOR = 1,
+    JOB_ERASE_BLOCK,
+    JOB_PROGRAM,
+    JOB_CRC,
+    JOB_PROGRAM_NOVERIFY,
+} job_op_t;
+
+typedef struct {
+    job_op_t op;
+    uint32_t address;
+    uint32_t length;
+} job_step_t;
+
+bool job_push(job_op_t op, uint32_t address, uint32_t length);
+void job_clear(void);
+bool job_run(void);
+bool job_is_running(void);
+uint32_t job_done(void);
+bool job_write_page(uint8_t *page);
+void job_step_cb(bool ok);
+void job_crc_cb(uint32_t crc);
+
+// callbacks
+void job_step_started_cb(uint8_t idx);
+void job_page_consumed_cb(void);
+void job_result_cb(uint32_t value);
+void job_complete_cb(bool ok, uint32_t address);
@@ -10,6 +10,9 @@
 
 #include <usbd.h>
 
+#include "event.h"
+#include "job.h"
+#include "sched.h"
 #include "spi.h"
 #include "spi_flash.h"
 #include "watchdog.h"
@@ -22,8 +25,64 @@ typedef enum {
     COMMAND_ERASE_SECTOR,
     COMMAND_ERASE_BLOCK,
     COMMAND_ERASE_CHIP,
+    COMMAND_OPERATION_STATUS,
+    COMMAND_SRAM_START,
+    COMMAND_SRAM_FINISH,
+    COMMAND_JOB_RUN,
+    COMMAND_CAPABILITIES,
 } command_t;
 
+// each capabilities request returns a single 24-bit value, selected by the
+// first data byte.
+typedef enum {
+    CAPABILITY_VERSION = 0,  // protocol version, job steps, job steps per report
+    CAPABILITY_FEATURES,
+    CAPABILITY_BUFFERS,  // page buffers, page size
+    CAPABILITY_SPI_CLOCK,  // kHz
+    CAPABILITY_BUILD_OPTIONS,
+    CAPABILITY_MAX_USB_LATENCY,  // us, with SCHED_STATS
+    CAPABILITY_MAX_TASK_RUN,  // us, with SCHED_STATS
+} capability_t;
+
+typedef enum {
+    FEATURE_JOBS = 1 << 0,
+    FEATURE_CRC = 1 << 1,
+    FEATURE_EVENTS = 1 << 2,  // asynchronous erases
+    FEATURE_SRAM = 1 << 3,
+    FEATURE_ADDRESS_4B = 1 << 4,
+    FEATURE_PROGRAM_NOVERIFY = 1 << 5,
+} feature_t;
+
+typedef enum {
+    BUILD_OPTION_SPI_MAX_FREQ = 1 << 0,
+    BUILD_OPTION_WATCHDOG_STOP_ON_HALT = 1 << 1,
+    BUILD_OPTION_SCHED_STATS = 1 << 2,
+} build_option_t;
+
+typedef enum {
+    TASK_USB = 0,
+    TASK_SPI_FLASH,
+} task_t;
+
+// service latency bounds, once a task is ready. USB is tighter, so that the
+// next host packet is not held back by back-to-back flash work, but flash
+// work still runs during request storms.
+#ifndef SCHED_USB_DEADLINE
+#define SCHED_USB_DEADLINE 100  // us
+#endif
+#ifndef SCHED_SPI_FLASH_DEADLINE
+#define SCHED_SPI_FLASH_DEADLINE 500  // us
+#endif
+
+#define PROTOCOL_VERSION 1
+
+typedef enum {
+    OPERATION_EVENT_PROGRESS = 1,
+    OPERATION_EVENT_COMPLETE,
+    OPERATION_EVENT_STEP,
+    OPERATION_EVENT_RESULT,
+} operation_event_id_t;
+
 typedef enum {
     STATUS_OK = 0,
     STATUS_UNPOWERED,
@@ -32,11 +91,15 @@ typedef enum {
     STATUS_INVALID_FLASH_PAGE_READ,
     STATUS_INVALID_FLASH_PAGE_WRITE,
     STATUS_LOCKED,
+    STATUS_JOB_FAILED,
 } status_t;
 
+// same layout as the 4-byte address page program instruction, the report id
+// (or the unused most significant address byte, for 3-byte addresses) is
+// replaced by the instruction and the buffer is sent as is.
 typedef struct __attribute__((packed)) {
     uint8_t report_id;  // always 1
-    uint8_t address[3];
+    uint8_t address[4];  // big endian
     uint8_t data[256];
 } flash_page_request_t;
 
@@ -48,7 +111,7 @@ typedef struct __attribute__((packed)) {
 typedef struct __attribute__((packed)) {
     uint8_t report_id;  // always 2
     uint8_t command;
-    uint8_t data[3];
+    uint8_t data[4];  // address, big endian
 } command_request_t;
 
 typedef struct __attribute__((packed)) {
@@ -57,28 +120,205 @@ typedef struct __attribute__((packed)) {
     uint8_t data[3];
 } command_response_t;
 
+typedef struct __attribute__((packed)) {
+    uint8_t report_id;  // always 3
+    uint8_t event;
+    uint8_t command;
+    uint8_t status;
+    uint8_t data[4];  // big endian
+} operation_event_t;
+
+#define JOB_REQUEST_STEPS 6
+
+typedef struct __attribute__((packed)) {
+    uint8_t report_id;  // always 4
+    uint8_t count;
+    struct __attribute__((packed)) {
+        uint8_t op;
+        uint8_t address[4];
+        uint8_t length[4];
+    } steps[JOB_REQUEST_STEPS];
+} job_request_t;
+
+#define OPERATION_PROGRESS_INTERVAL 100  // ms
+
+// a whole job can post a step and a result event per step, plus the
+// completion and one progress event, before the host reads any of them.
+#define EVENT_QUEUE_SIZE (2 * JOB_MAX_STEPS + 2)
+
 static bool wip = false;
 static bool powered = false;
+static bool sram = false;
 
 static bool set_flash_rx = false;
 static bool set_flash_tx = false;
 static bool set_response = false;
+static bool in_busy = false;
+static bool discard_pages = false;
+static bool job_page = false;
 
-static uint8_t buf[SPI_FLASH_PAGE_SIZE + 4];
+static uint8_t buf[sizeof(flash_page_request_t)] __attribute__((aligned(4)));
 static uint16_t buf_idx = 0;
+static uint8_t *flash_tx = NULL;
+
+static command_response_t response;
+
+static operation_event_t events[EVENT_QUEUE_SIZE];
+static uint8_t events_head = 0;
+static uint8_t events_len = 0;
+static command_t operation = 0;
+static uint32_t operation_elapsed = 0;
+static uint8_t flash_status = 0;
+
+
+static inline uint32_t
+get_address(const uint8_t *b)
+{
+    return (b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+}
 
 
 static void
-send_response(status_t status, uint8_t *data, uint32_t data_len)
+in_kick(void)
 {
-    command_response_t *response = (command_response_t*) buf;
-    response->report_id = 2;
-    response->status = powered ? status : STATUS_UNPOWERED;
-    memset(response->data, 0, sizeof(response->data));
+    if (!in_busy)
+        usbd_in_cb(1);
+}
+
+
+static void
+send_raw_response(status_t status, uint8_t *data, uint32_t data_len)
+{
+    response.report_id = 2;
+    response.status = status;
+    memset(response.data, 0, sizeof(response.data));
     if (data != NULL)
-        memcpy(response->data, data, data_len <= 3 ? data_len : 3);
+        memcpy(response.data, data, data_len <= 3 ? data_len : 3);
     set_response = true;
-    usbd_in_cb(1);
+    in_kick();
+}
+
+
+static void
+send_response(status_t status, uint8_t *data, uint32_t data_len)
+{
+    send_raw_response(powered ? status : STATUS_UNPOWERED, data, data_len);
+}
+
+
+static void
+send_capability(uint8_t selector)
+{
+    uint32_t value = 0;
+
+    switch ((capability_t) selector) {
+    case CAPABILITY_VERSION:
+        value = (PROTOCOL_VERSION << 16) | (JOB_MAX_STEPS << 8) | JOB_REQUEST_STEPS;
+        break;
+
+    case CAPABILITY_FEATURES:
+        value = FEATURE_JOBS | FEATURE_CRC | FEATURE_EVENTS | FEATURE_SRAM |
+            FEATURE_ADDRESS_4B | FEATURE_PROGRAM_NOVERIFY;
+        break;
+
+    case CAPABILITY_BUFFERS:
+        value = (1 << 16) | SPI_FLASH_PAGE_SIZE;
+        break;
+
+    case CAPABILITY_SPI_CLOCK:
+        value = (SystemCoreClock >> (((SPI1->CR1 & SPI_CR1_BR) >> SPI_CR1_BR_Pos) + 1)) / 1000;
+        break;
+
+    case CAPABILITY_BUILD_OPTIONS:
+#ifdef SPI_MAX_FREQ
+        value |= BUILD_OPTION_SPI_MAX_FREQ;
+#endif
+#ifdef WATCHDOG_STOP_ON_HALT
+        value |= BUILD_OPTION_WATCHDOG_STOP_ON_HALT;
+#endif
+#ifdef SCHED_STATS
+        value |= BUILD_OPTION_SCHED_STATS;
+#endif
+        break;
+
+#ifdef SCHED_STATS
+    case CAPABILITY_MAX_USB_LATENCY:
+        value = sched_max_latency(TASK_USB);
+        break;
+
+    case CAPABILITY_MAX_TASK_RUN:
+        value = sched_max_run();
+        break;
+#endif
+
+    default:
+        send_raw_response(STATUS_INVALID_REQUEST, NULL, 0);
+        return;
+    }
+
+    if (value > 0xffffff)
+        value = 0xffffff;
+
+    // answered even when unpowered, the host negotiates the protocol before
+    // powering up.
+    uint8_t data[] = {value >> 16, value >> 8, value};
+    send_raw_response(STATUS_OK, data, sizeof(data));
+}
+
+
+static void
+send_event(operation_event_id_t event, status_t status, uint32_t data)
+{
+    operation_event_t *e = NULL;
+
+    // progress events only carry the latest value, a queued one that was not
+    // sent yet is updated instead of adding another.
+    if (event == OPERATION_EVENT_PROGRESS && events_len > 0) {
+        operation_event_t *last = &events[(events_head + events_len - 1) % EVENT_QUEUE_SIZE];
+        if (last->event == OPERATION_EVENT_PROGRESS)
+            e = last;
+    }
+
+    if (e == NULL) {
+        if (events_len == EVENT_QUEUE_SIZE) {
+            if (event == OPERATION_EVENT_PROGRESS)
+                return;
+
+            // not expected with the queue size, but the completion must
+            // not be lost.
+            events_head = (events_head + 1) % EVENT_QUEUE_SIZE;
+            events_len--;
+        }
+        e = &events[(events_head + events_len) % EVENT_QUEUE_SIZE];
+        events_len++;
+    }
+
+    e->report_id = 3;
+    e->event = event;
+    e->command = operation;
+    e->status = powered ? status : STATUS_UNPOWERED;
+    e->data[0] = data >> 24;
+    e->data[1] = data >> 16;
+    e->data[2] = data >> 8;
+    e->data[3] = data;
+    in_kick();
+}
+
+
+static void
+operation_start(command_t cmd)
+{
+    operation = cmd;
+    operation_elapsed = 0;
+    send_response(STATUS_OK, NULL, 0);
+}
+
+
+static void
+operation_complete(status_t status)
+{
+    send_event(OPERATION_EVENT_COMPLETE, status, operation_elapsed);
+    operation = 0;
 }
 
 
@@ -104,46 +344,154 @@ spi_flash_jedec_id_cb(uint8_t manufacturer_id, uint16_t device_id)
 }
 
 void
-spi_flash_read_cb(const uint8_t *buff, uint32_t len)
+spi_flash_read_cb(uint8_t *buff, uint32_t len)
 {
     if (len != SPI_FLASH_PAGE_SIZE) {
+        spi_flash_read_release();
         send_response(STATUS_INVALID_FLASH_PAGE_READ, NULL, 0);
         return;
     }
 
-    flash_page_response_t *response = (flash_page_response_t*) buf;
-    response->report_id = 1;
-    memcpy(response->data, buff, len);
+    // sent straight from the spi buffer, the byte before the data is the
+    // last address byte, replaced by the report id.
+    flash_tx = buff - 1;
+    ((flash_page_response_t*) flash_tx)->report_id = 1;
     buf_idx = 0;
     set_flash_tx = true;
-    usbd_in_cb(1);
+    in_kick();
 }
 
 void
-spi_flash_erase_sector_cb(void)
+spi_flash_sram_start_cb(void)
 {
+    sram = true;
     send_response(STATUS_OK, NULL, 0);
 }
 
 void
-spi_flash_erase_block_cb(void)
+spi_flash_sram_write_cb(void)
 {
     send_response(STATUS_OK, NULL, 0);
 }
 
 void
-spi_flash_erase_chip_cb(void)
+spi_flash_sram_finish_cb(void)
 {
     send_response(STATUS_OK, NULL, 0);
+
+    // the FPGA is now running from CRAM, and the flash is in deep power-down.
+    sram = false;
+    powered = false;
+}
+
+void
+spi_flash_status_cb(uint8_t status)
+{
+    flash_status = status;
+
+    if (operation == 0)
+        return;
+
+    // status is polled every 1ms while waiting for the flash. jobs report
+    // the amount of bytes processed, instead of elapsed time.
+    if ((++operation_elapsed % OPERATION_PROGRESS_INTERVAL) == 0)
+        send_event(OPERATION_EVENT_PROGRESS, STATUS_OK, operation == COMMAND_JOB_RUN ? job_done() : operation_elapsed);
+}
+
+void
+spi_flash_erase_sector_cb(void)
+{
+    if (job_is_running()) {
+        job_step_cb(true);
+        return;
+    }
+    operation_complete(STATUS_OK);
+}
+
+void
+spi_flash_erase_block_cb(void)
+{
+    if (job_is_running()) {
+        job_step_cb(true);
+        return;
+    }
+    operation_complete(STATUS_OK);
+}
+
+void
+spi_flash_erase_chip_cb(void)
+{
+    operation_complete(STATUS_OK);
     watchdog_set_reload_default();
 }
 
 void
 spi_flash_write_cb(bool verified)
 {
+    if (job_is_running()) {
+        job_step_cb(verified);
+        return;
+    }
     send_response(verified ? STATUS_OK : STATUS_INVALID_FLASH_PAGE_WRITE, NULL, 0);
 }
 
+void
+spi_flash_crc_cb(uint32_t crc)
+{
+    job_crc_cb(crc);
+}
+
+
+void
+job_step_started_cb(uint8_t idx)
+{
+    send_event(OPERATION_EVENT_STEP, STATUS_OK, idx);
+}
+
+static void
+page_release(void)
+{
+    if (!job_page)
+        return;
+
+    job_page = false;
+    wip = false;
+    usbd_out_enable(1);
+}
+
+void
+spi_flash_page_release_cb(void)
+{
+    // pages written directly are released with the response, after verify
+    page_release();
+}
+
+void
+job_page_consumed_cb(void)
+{
+    page_release();
+}
+
+void
+job_result_cb(uint32_t value)
+{
+    send_event(OPERATION_EVENT_RESULT, STATUS_OK, value);
+}
+
+void
+job_complete_cb(bool ok, uint32_t address)
+{
+    if (ok) {
+        operation_complete(STATUS_OK);
+        return;
+    }
+
+    // pages already sent by the host for the failed job must be dropped.
+    discard_pages = true;
+    send_event(OPERATION_EVENT_COMPLETE, STATUS_JOB_FAILED, address);
+    operation = 0;
+}
+
 
 void
 usbd_in_cb(uint8_t ept)
@@ -151,14 +499,19 @@ usbd_in_cb(uint8_t ept)
     if (ept != 1)
         return;
 
+    in_busy = false;
+
     if (set_flash_tx) {
+        in_busy = true;
         if ((sizeof(flash_page_response_t) - buf_idx) > USBD_EP1_IN_SIZE) {
-            usbd_in(ept, buf + buf_idx, USBD_EP1_IN_SIZE);
+            usbd_in(ept, flash_tx + buf_idx, USBD_EP1_IN_SIZE);
             buf_idx += USBD_EP1_IN_SIZE;
         } else {
-            usbd_in(ept, buf + buf_idx, sizeof(flash_page_response_t) - buf_idx);
+            usbd_in(ept, flash_tx + buf_idx, sizeof(flash_page_response_t) - buf_idx);
             buf_idx = 0;
             set_flash_tx = false;
+            flash_tx = NULL;
+            spi_flash_read_release();
             wip = false;
             usbd_out_enable(1);
         }
@@ -166,10 +519,19 @@ usbd_in_cb(uint8_t ept)
     }
 
     if (set_response) {
-        usbd_in(ept, buf, sizeof(command_response_t));
+        usbd_in(ept, &response, sizeof(response));
+        in_busy = true;
         set_response = false;
         wip = false;
         usbd_out_enable(1);
+        return;
+    }
+
+    if (events_len > 0) {
+        usbd_in(ept, &events[events_head], sizeof(events[events_head]));
+        in_busy = true;
+        events_head = (events_head + 1) % EVENT_QUEUE_SIZE;
+        events_len--;
     }
 }
 
@@ -187,7 +549,27 @@ usbd_out_cb(uint8_t ept)
             buf_idx = 0;
             set_flash_rx = false;
             flash_page_request_t *request = (flash_page_request_t*) buf;
-            if (!spi_flash_write(request->address[0], request->address[1], request->address[2], request->data, sizeof(request->data)))
+            if (discard_pages) {
+                wip = false;
+                usbd_out_enable(ept);
+                return;
+            }
+            if (job_is_running()) {
+                // the buffer is held, and the endpoint kept disabled, until
+                // the page is sent to the flash.
+                job_page = true;
+                if (!job_write_page(buf)) {
+                    job_page = false;
+                    send_response(STATUS_LOCKED, NULL, 0);
+                }
+                return;
+            }
+            if (sram) {
+                if (!spi_flash_sram_write(request->data, sizeof(request->data)))
+                    send_response(STATUS_LOCKED, NULL, 0);
+                return;
+            }
+            if (!spi_flash_write(buf, true))
                 send_response(STATUS_LOCKED, NULL, 0);
             return;
         }
@@ -196,20 +578,31 @@ usbd_out_cb(uint8_t ept)
         return;
     }
 
-    uint8_t buff[USBD_EP1_OUT_SIZE];
-    uint16_t len = usbd_out(ept, buff, sizeof(buff), false);
+    // every report lands in the page buffer, so pages are never copied. it is
+    // always free here, the endpoint is only enabled after the previous
+    // request released it.
+    uint8_t *buff = buf;
+    uint16_t len = usbd_out(ept, buff, USBD_EP1_OUT_SIZE, false);
 
     wip = true;
 
     switch (buff[0]) {
     case 1:
-        memcpy(buf, buff, len);
         buf_idx = len;
         set_flash_rx = true;
         usbd_out_enable(ept);
         break;
 
     case 2:
+        discard_pages = false;
+
+        // accepted with any length and state, including the shorter request
+        // of firmware without capabilities, that hosts use to probe for it.
+        if (len >= 3 && buff[1] == COMMAND_CAPABILITIES) {
+            send_capability(buff[2]);
+            break;
+        }
+
         if (len != sizeof(command_request_t)) {
             send_response(STATUS_INVALID_REQUEST, NULL, 0);
             break;
@@ -217,6 +610,18 @@ usbd_out_cb(uint8_t ept)
 
         command_request_t *request = (command_request_t*) buff;
 
+        // the flash is busy until the pending operation completes
+        if (operation != 0 && request->command != COMMAND_OPERATION_STATUS) {
+            send_response(STATUS_LOCKED, NULL, 0);
+            break;
+        }
+
+        // the bus belongs to the FPGA until the configuration is finished
+        if (sram && request->command != COMMAND_SRAM_FINISH && request->command != COMMAND_OPERATION_STATUS) {
+            send_response(STATUS_LOCKED, NULL, 0);
+            break;
+        }
+
         switch ((command_t) request->command) {
         case COMMAND_POWER_UP:
             if (!spi_flash_powerup())
@@ -224,6 +629,10 @@ usbd_out_cb(uint8_t ept)
             break;
 
         case COMMAND_POWER_DOWN:
+            if (!powered) {
+                send_response(STATUS_OK, NULL, 0);
+                break;
+            }
             if (!spi_flash_powerdown())
                 send_response(STATUS_LOCKED, NULL, 0);
             break;
@@ -234,42 +643,136 @@ usbd_out_cb(uint8_t ept)
             break;
 
         case COMMAND_READ:
-            if (!spi_flash_read(request->data[0], request->data[1], request->data[2]))
+            if (!spi_flash_read(get_address(request->data)))
                 send_response(STATUS_LOCKED, NULL, 0);
             break;
 
         case COMMAND_ERASE_SECTOR:
-            if (!spi_flash_erase_sector(request->data[0], request->data[1], request->data[2]))
-                send_response(STATUS_LOCKED, NULL, 0);
+            if (spi_flash_erase_sector(get_address(request->data))) {
+                operation_start(COMMAND_ERASE_SECTOR);
+                break;
+            }
+            send_response(STATUS_LOCKED, NULL, 0);
             break;
 
         case COMMAND_ERASE_BLOCK:
-            if (!spi_flash_erase_block(request->data[0], request->data[1], request->data[2]))
-                send_response(STATUS_LOCKED, NULL, 0);
+            if (spi_flash_erase_block(get_address(request->data))) {
+                operation_start(COMMAND_ERASE_BLOCK);
+                break;
+            }
+            send_response(STATUS_LOCKED, NULL, 0);
             break;
 
         case COMMAND_ERASE_CHIP:
             if (spi_flash_erase_chip()) {
                 watchdog_set_reload_erase_chip();
+                operation_start(COMMAND_ERASE_CHIP);
                 break;
             }
             send_response(STATUS_LOCKED, NULL, 0);
             break;
 
+        case COMMAND_SRAM_START:
+            if (!powered) {
+                send_response(STATUS_UNPOWERED, NULL, 0);
+                break;
+            }
+            if (!spi_flash_sram_start())
+                send_response(STATUS_LOCKED, NULL, 0);
+            break;
+
+        case COMMAND_SRAM_FINISH:
+            if (!sram) {
+                send_response(STATUS_INVALID_REQUEST, NULL, 0);
+                break;
+            }
+            if (!spi_flash_sram_finish())
+                send_response(STATUS_LOCKED, NULL, 0);
+            break;
+
+        case COMMAND_JOB_RUN:
+            if (job_run()) {
+                operation_start(COMMAND_JOB_RUN);
+                break;
+            }
+            send_response(STATUS_INVALID_REQUEST, NULL, 0);
+            break;
+
+        case COMMAND_OPERATION_STATUS: {
+                uint8_t st[] = {operation, flash_status, 0};
+                send_response(STATUS_OK, st, sizeof(st));
+            }
+            break;
+
         default:
             send_response(STATUS_INVALID_COMMAND_ID, NULL, 0);
             return;
         }
         break;
+
+    case 4: {
+            discard_pages = false;
+
+            job_request_t *request = (job_request_t*) buff;
+            if (len != sizeof(job_request_t) || request->count > JOB_REQUEST_STEPS) {
+                send_response(STATUS_INVALID_REQUEST, NULL, 0);
+                break;
+            }
+
+            if (operation != 0 || sram) {
+                send_response(STATUS_LOCKED, NULL, 0);
+                break;
+            }
+
+            // an empty request clears the queued steps
+            if (request->count == 0)
+                job_clear();
+
+            status_t status = STATUS_OK;
+            for (uint8_t i = 0; i < request->count; i++) {
+                if (!job_push(request->steps[i].op, get_address(request->steps[i].address), get_address(request->steps[i].length))) {
+                    job_clear();
+                    status = STATUS_INVALID_REQUEST;
+                    break;
+                }
+            }
+            send_response(status, NULL, 0);
+        }
+        break;
     }
 }
 
 
+static void
+usb_irq_enable(void)
+{
+    // the library services the peripheral from usbd_task, the interrupt only
+    // wakes up the main loop.
+    USB->CNTR |= USB_CNTR_CTRM | USB_CNTR_RESETM | USB_CNTR_SOFM;
+    NVIC_EnableIRQ(USB_IRQn);
+}
+
+
+void
+USB_IRQHandler(void)
+{
+    // masked until the main loop handles it, the flags are only cleared by
+    // usbd_task.
+    NVIC_DisableIRQ(USB_IRQn);
+    event_post(EVENT_USB);
+}
+
+
 void
 usbd_reset_hook_cb(bool before)
 {
-    if (before)
+    if (before) {
         GPIOA->BSRR = GPIO_BSRR_BS_15;
+        return;
+    }
+
+    // the reset handling may reconfigure the interrupt mask
+    usb_irq_enable();
 }
 
 void
@@ -282,7 +785,7 @@ usbd_set_address_hook_cb(uint8_t addr)
 void
 usbd_sof_cb(void)
 {
-    if (!wip)
+    if (!wip && !spi_flash_is_locked())
         watchdog_reload();
 }
 
@@ -329,10 +832,28 @@ clock_init(void)
 }
 
 
+static bool
+usb_task(void)
+{
+    if (event_take(EVENT_USB)) {
+        usbd_task();
+        NVIC_EnableIRQ(USB_IRQn);
+    }
+    return false;
+}
+
+
+static const sched_task_t tasks[] = {
+    [TASK_USB] = {EVENT_USB, usb_task, SCHED_USB_DEADLINE},
+    [TASK_SPI_FLASH] = {EVENT_SPI | EVENT_TIMER | EVENT_FLASH, spi_flash_task, SCHED_SPI_FLASH_DEADLINE},
+};
+
+
 int
 main(void)
 {
     clock_init();
+    sched_init();
 
     RCC->AHBENR |= RCC_AHBENR_GPIOAEN;
 
@@ -342,13 +863,9 @@ main(void)
 
     watchdog_init();
     usbd_init();
+    usb_irq_enable();
     spi_flash_init();
 
-    while (true) {
-        if (spi_flash_task())
-            continue;
-
-        usbd_task();
-    }
+    sched_run(tasks, sizeof(tasks) / sizeof(tasks[0]));
     return 0;
 }
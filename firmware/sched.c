@@ -0,0 +1,127 @@
+// SPDX-FileCopyrightText: 2025 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <stm32f0xx.h>
+
+#include "event.h"
+#include "sched.h"
+
+static bool more[SCHED_MAX_TASKS];
+static uint32_t more_since[SCHED_MAX_TASKS];
+
+#ifdef SCHED_STATS
+static uint32_t max_latency[SCHED_MAX_TASKS];
+static uint32_t max_run = 0;
+#endif
+
+
+void
+sched_init(void)
+{
+    // free running 32-bit microsecond timestamps
+    RCC->APB1ENR |= RCC_APB1ENR_TIM2EN;
+    TIM2->PSC = SystemCoreClock / 1000000 - 1;
+    TIM2->ARR = 0xffffffff;
+    TIM2->EGR = TIM_EGR_UG;
+    TIM2->CR1 = TIM_CR1_CEN;
+}
+
+
+uint32_t
+sched_now(void)
+{
+    return TIM2->CNT;
+}
+
+
+static bool
+task_ready(const sched_task_t *task, uint8_t idx, uint32_t now, uint32_t *since)
+{
+    bool rv = false;
+    uint32_t age = 0;
+
+    if (event_pending(task->events)) {
+        // may have been posted after now was read
+        int32_t a = (int32_t) (now - event_posted_at(task->events));
+        age = a > 0 ? a : 0;
+        rv = true;
+    }
+
+    if (more[idx] && (!rv || now - more_since[idx] > age)) {
+        age = now - more_since[idx];
+        rv = true;
+    }
+
+    *since = now - age;
+    return rv;
+}
+
+
+void
+sched_run(const sched_task_t *tasks, uint8_t tasks_len)
+{
+    // earliest deadline first: every run is a single bounded step, so the
+    // service latency of a task is bounded by its deadline, plus the longest
+    // step of any other task, as long as the deadlines are feasible.
+    while (true) {
+        uint32_t now = sched_now();
+        const sched_task_t *next = NULL;
+        uint8_t next_idx = 0;
+        uint32_t next_since = 0;
+        int32_t next_slack = 0;
+
+        for (uint8_t i = 0; i < tasks_len && i < SCHED_MAX_TASKS; i++) {
+            uint32_t since;
+            if (!task_ready(&tasks[i], i, now, &since))
+                continue;
+
+            int32_t slack = (int32_t) (since + tasks[i].deadline - now);
+            if (next == NULL || slack < next_slack) {
+                next = &tasks[i];
+                next_idx = i;
+                next_since = since;
+                next_slack = slack;
+            }
+        }
+
+        if (next == NULL) {
+            event_wait();
+            continue;
+        }
+
+        more[next_idx] = next->run();
+        uint32_t end = sched_now();
+        more_since[next_idx] = end;
+
+#ifdef SCHED_STATS
+        if (now - next_since > max_latency[next_idx])
+            max_latency[next_idx] = now - next_since;
+        if (end - now > max_run)
+            max_run = end - now;
+#else
+        (void) next_since;
+#endif
+    }
+}
+
+
+#ifdef SCHED_STATS
+
+uint32_t
+sched_max_latency(uint8_t task)
+{
+    return task < SCHED_MAX_TASKS ? max_latency[task] : 0;
+}
+
+
+uint32_t
+sched_max_run(void)
+{
+    return max_run;
+}
+
+#endif
@@ -0,0 +1,28 @@
+// SPDX-FileCopyrightText: 2025 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "event.h"
+
+#ifndef SCHED_MAX_TASKS
+#define SCHED_MAX_TASKS 4
+#endif
+
+typedef struct {
+    event_t events;  // events that make the task ready
+    bool (*run)(void);  // runs one bounded step, returns true if more work is pending
+    uint32_t deadline;  // us, maximum service latency once ready
+} sched_task_t;
+
+void sched_init(void);
+uint32_t sched_now(void);
+void sched_run(const sched_task_t *tasks, uint8_t tasks_len);
+
+#ifdef SCHED_STATS
+uint32_t sched_max_latency(uint8_t task);
+uint32_t sched_max_run(void);
+#endif
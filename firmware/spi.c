@@ -7,11 +7,16 @@
 
 #include <stm32f0xx.h>
 
+#include "event.h"
 #include "spi.h"
 
-static uint8_t tx_buf[SPI_BUFFER_SIZE];
-static uint8_t rx_buf[SPI_BUFFER_SIZE];
+// transfers run in place: received bytes overwrite the transmitted ones,
+// that were already fetched by the tx dma channel.
+static uint8_t spi_buf[SPI_BUFFER_SIZE] __attribute__((aligned(4)));
+static uint8_t *locked_buf = NULL;
 static uint32_t locked_len = 0;
+static bool buffer_held = false;
+static bool cs_hold = false;
 
 
 void
@@ -43,18 +48,41 @@ spi_init(void)
     DMA1_Channel2->CCR = DMA_CCR_PL | DMA_CCR_MINC | DMA_CCR_TCIE;
 
     DMA1_Channel3->CPAR = (uint32_t) &(SPI1->DR);
-    DMA1_Channel3->CCR = DMA_CCR_DIR | DMA_CCR_PL | DMA_CCR_MINC | DMA_CCR_TCIE;
+    DMA1_Channel3->CCR = DMA_CCR_DIR | DMA_CCR_PL | DMA_CCR_MINC;
+
+    NVIC_EnableIRQ(DMA1_Channel2_3_IRQn);
+}
+
+
+void
+DMA1_Channel2_3_IRQHandler(void)
+{
+    // rx completes after tx, it is the only transfer complete we care about
+    if ((DMA1->ISR & DMA_ISR_TCIF2) == DMA_ISR_TCIF2) {
+        DMA1->IFCR = DMA_IFCR_CTCIF2 | DMA_IFCR_CTCIF3;
+        event_post(EVENT_SPI);
+    }
 }
 
 
 uint8_t*
 spi_lock(uint32_t len)
 {
-    if (locked_len != 0 || len > sizeof(tx_buf))
+    if (!spi_lock_buffer(spi_buf, len))
         return NULL;
+    return spi_buf;
+}
+
 
+bool
+spi_lock_buffer(uint8_t *buf, uint32_t len)
+{
+    if (locked_len != 0 || buf == NULL || len == 0 || (buf == spi_buf && len > sizeof(spi_buf)))
+        return false;
+
+    locked_buf = buf;
     locked_len = len;
-    return tx_buf;
+    return true;
 }
 
 
@@ -68,11 +96,11 @@ spi_start_transfer(void)
 
     spi_hook_cb(true);
 
-    DMA1_Channel2->CMAR = (uint32_t) rx_buf;
+    DMA1_Channel2->CMAR = (uint32_t) locked_buf;
     DMA1_Channel2->CNDTR = locked_len;
     DMA1_Channel2->CCR |= DMA_CCR_EN;
 
-    DMA1_Channel3->CMAR = (uint32_t) tx_buf;
+    DMA1_Channel3->CMAR = (uint32_t) locked_buf;
     DMA1_Channel3->CNDTR = locked_len;
     DMA1_Channel3->CCR |= DMA_CCR_EN;
 
@@ -85,28 +113,59 @@ spi_start_transfer(void)
 bool
 spi_task()
 {
-    if ((DMA1->ISR & DMA_ISR_TCIF2) != DMA_ISR_TCIF2)
+    if (!event_take(EVENT_SPI))
         return false;
 
     SPI1->CR2 &= ~(SPI_CR2_RXDMAEN | SPI_CR2_TXDMAEN);
 
-    DMA1->IFCR = DMA_IFCR_CTCIF2 | DMA_IFCR_CTCIF3;
     DMA1_Channel2->CCR &= ~DMA_CCR_EN;
     DMA1_Channel3->CCR &= ~DMA_CCR_EN;
 
-    GPIOA->BSRR = GPIO_BSRR_BS_4;
+    if (!cs_hold)
+        GPIOA->BSRR = GPIO_BSRR_BS_4;
 
-    spi_transfer_complete_cb(rx_buf, locked_len);
+    spi_transfer_complete_cb(locked_buf, locked_len);
 
-    locked_len = 0;
+    if (!buffer_held) {
+        locked_buf = NULL;
+        locked_len = 0;
+    }
 
     spi_hook_cb(false);
     return true;
 }
 
 
+void
+spi_hold_buffer(void)
+{
+    // called from the transfer complete callback, to keep the received data
+    // locked until spi_unlock.
+    buffer_held = true;
+}
+
+
+void
+spi_unlock(void)
+{
+    buffer_held = false;
+    locked_buf = NULL;
+    locked_len = 0;
+}
+
+
 bool
 spi_is_locked(void)
 {
     return locked_len != 0;
 }
+
+
+void
+spi_hold_cs(bool hold)
+{
+    // keeps chip select asserted between transfers, for targets that expect
+    // a single continuous transaction (e.g. iCE40 SPI slave configuration).
+    cs_hold = hold;
+    GPIOA->BSRR = hold ? GPIO_BSRR_BR_4 : GPIO_BSRR_BS_4;
+}
@@ -7,15 +7,19 @@
 #include <stdint.h>
 
 #ifndef SPI_BUFFER_SIZE
-#define SPI_BUFFER_SIZE 260
+#define SPI_BUFFER_SIZE 261  // 4-byte address read instruction + page
 #endif
 
 void spi_init(void);
 uint8_t* spi_lock(uint32_t len);
+bool spi_lock_buffer(uint8_t *buf, uint32_t len);
 bool spi_start_transfer(void);
 bool spi_task(void);
+void spi_hold_buffer(void);
+void spi_unlock(void);
 bool spi_is_locked(void);
+void spi_hold_cs(bool hold);
 
 // callbacks
-void spi_transfer_complete_cb(const uint8_t *buf, uint32_t buf_len);
+void spi_transfer_complete_cb(uint8_t *buf, uint32_t buf_len);
 void spi_hook_cb(bool before);
@@ -8,6 +8,8 @@
 
 #include <stm32f0xx.h>
 
+#include "crc.h"
+#include "event.h"
 #include "spi.h"
 #include "spi_flash.h"
 
@@ -22,27 +24,150 @@ typedef enum {
     POWER_DOWN = 0xb9,
     ERASE_CHIP = 0xc7,
     ERASE_BLOCK = 0xd8,
+
+    // 4-byte address variants, used for addresses above 16MB
+    READ_4B = 0x13,
+    WRITE_4B = 0x12,
+    ERASE_SECTOR_4B = 0x21,
+    ERASE_BLOCK_4B = 0xdc,
+
+    // not flash instructions, iCE40 SPI slave configuration
+    SRAM_DATA = 0x100,
+    SRAM_FINISH,
 } instruction_t;
 
-static bool waiting_wel_erase_sector = false;
-static bool waiting_wel_erase_block = false;
-static bool waiting_wel_erase_chip = false;
-static bool waiting_wel_write = false;
-static bool waiting_erase_sector = false;
-static bool waiting_erase_block = false;
-static bool waiting_erase_chip = false;
-static bool waiting_write = false;
-static bool waiting_write_verify = false;
-static bool start_write = false;
-static bool start_write_verify = false;
-static bool start_erase_sector = false;
-static bool start_erase_block = false;
-static bool start_erase_chip = false;
-
-static uint8_t flash_buf[SPI_BUFFER_SIZE];
-static uint32_t flash_buf_locked_len = 0;
+#define STATUS_WIP (1 << 0)
+#define STATUS_WEL (1 << 1)
+
+#define ADDRESS_4B 0x1000000
+
+#define SRAM_RESET_TICKS 3  // 1ms with CRESET low, >1.2ms for CRAM clear
+#define SRAM_DUMMY_BYTES 7  // at least 49 clock cycles after bitstream
+
+typedef enum {
+    STEP_END = 0,
+    STEP_WRITE_ENABLE,  // send write enable
+    STEP_WAIT_WEL,      // poll status until write enable latch is set
+    STEP_COMMAND,       // send the staged command (or page) buffer
+    STEP_WAIT_READY,    // poll status until write in progress is cleared
+    STEP_VERIFY,        // read back the staged page and compare its CRC
+    STEP_CRC,           // read range, chunk by chunk, into the CRC unit
+    STEP_SRAM_RESET,    // hold chip select and pulse CRESET
+} step_t;
+
+typedef struct {
+    const step_t *steps;
+    void (*complete)(bool ok);
+} sequence_t;
+
+static const step_t steps_erase[] = {
+    STEP_WRITE_ENABLE,
+    STEP_WAIT_WEL,
+    STEP_COMMAND,
+    STEP_WAIT_READY,
+    STEP_END,
+};
+
+static const step_t steps_write[] = {
+    STEP_WRITE_ENABLE,
+    STEP_WAIT_WEL,
+    STEP_COMMAND,
+    STEP_WAIT_READY,
+    STEP_VERIFY,
+    STEP_END,
+};
+
+static const step_t steps_write_noverify[] = {
+    STEP_WRITE_ENABLE,
+    STEP_WAIT_WEL,
+    STEP_COMMAND,
+    STEP_WAIT_READY,
+    STEP_END,
+};
+
+static const step_t steps_crc[] = {
+    STEP_CRC,
+    STEP_END,
+};
+
+static const step_t steps_sram_start[] = {
+    STEP_COMMAND,
+    STEP_SRAM_RESET,
+    STEP_END,
+};
+
+static void
+complete_erase_sector(bool ok)
+{
+    (void) ok;
+    spi_flash_erase_sector_cb();
+}
+
+static void
+complete_erase_block(bool ok)
+{
+    (void) ok;
+    spi_flash_erase_block_cb();
+}
+
+static void
+complete_erase_chip(bool ok)
+{
+    (void) ok;
+    spi_flash_erase_chip_cb();
+}
+
+static void
+complete_write(bool ok)
+{
+    spi_flash_write_cb(ok);
+}
+
+static void
+complete_crc(bool ok)
+{
+    (void) ok;
+    spi_flash_crc_cb(crc_get());
+}
+
+static void
+complete_sram_start(bool ok)
+{
+    (void) ok;
+    spi_flash_sram_start_cb();
+}
+
+static const sequence_t sequence_erase_sector = {steps_erase, complete_erase_sector};
+static const sequence_t sequence_erase_block = {steps_erase, complete_erase_block};
+static const sequence_t sequence_erase_chip = {steps_erase, complete_erase_chip};
+static const sequence_t sequence_write = {steps_write, complete_write};
+static const sequence_t sequence_write_noverify = {steps_write_noverify, complete_write};
+static const sequence_t sequence_crc = {steps_crc, complete_crc};
+static const sequence_t sequence_sram_start = {steps_sram_start, complete_sram_start};
+
+static const sequence_t *sequence = NULL;
+static uint8_t step = 0;
+static bool step_pending = false;
+static bool sequence_ok = true;
+
+// commands are sent in place from the staged buffer, either the small
+// command buffer or a page buffer owned by the caller until it is released.
+static uint8_t command_buf[5];
+static uint8_t *staged_buf = NULL;
+static uint32_t staged_len = 0;
+static instruction_t staged_instruction = 0;
+
+// page data is only needed by the verify step as a CRC, calculated when
+// staging it.
+static uint32_t write_address = 0;
+static uint32_t write_crc = 0;
+
+static uint32_t crc_address = 0;
+static uint32_t crc_remaining = 0;
+static uint8_t sram_ticks = 0;
 
 static instruction_t instruction = 0;
+static uint8_t read_header_len = 0;
 
 
 void
@@ -58,52 +183,180 @@ spi_flash_init(void)
 
     TIM3->PSC = SystemCoreClock / 10000 - 1;  // 0.1ms per tick
     TIM3->ARR = 10 - 1;  // 1ms
+    TIM3->CR1 = TIM_CR1_URS;  // only overflows raise the update interrupt
     TIM3->DIER = TIM_DIER_UIE;
+    NVIC_EnableIRQ(TIM3_IRQn);
 
+    crc_init();
     spi_init();
 }
 
 
-bool
-spi_flash_task(void)
+void
+TIM3_IRQHandler(void)
 {
-    if (start_erase_sector || start_erase_block || start_erase_chip || start_write) {
-        uint8_t *buf = spi_lock(flash_buf_locked_len);
-        if (buf == NULL)
-            return false;
+    TIM3->SR &= ~TIM_SR_UIF;
+    event_post(EVENT_TIMER);
+}
 
-        if (start_erase_sector) {
-            start_erase_sector = false;
-            waiting_erase_sector = true;
-        }
-        else if (start_erase_block) {
-            start_erase_block = false;
-            waiting_erase_block = true;
-        }
-        else if (start_erase_chip) {
-            start_erase_chip = false;
-            waiting_erase_chip = true;
-        }
-        else if (start_write) {
-            start_write = false;
-            waiting_write = true;
+
+static inline void
+timer_start(bool immediate)
+{
+    TIM3->EGR = TIM_EGR_UG;
+    TIM3->CR1 |= TIM_CR1_CEN;
+    if (immediate)
+        event_post(EVENT_TIMER);
+}
+
+
+static inline void
+timer_stop(void)
+{
+    TIM3->CR1 &= ~TIM_CR1_CEN;
+    event_clear(EVENT_TIMER);
+}
+
+
+static bool
+sequence_start(const sequence_t *seq)
+{
+    if (sequence != NULL)
+        return false;
+
+    sequence = seq;
+    sequence_ok = true;
+    step = 0;
+    step_pending = true;
+    event_post(EVENT_FLASH);
+    return true;
+}
+
+
+static inline void
+sequence_next(void)
+{
+    step++;
+    step_pending = true;
+    event_post(EVENT_FLASH);
+}
+
+
+static uint8_t
+put_address(uint8_t *buf, instruction_t inst, instruction_t inst_4b, uint32_t address)
+{
+    // 4-byte opcodes only exist in parts larger than 16MB, use them only
+    // when required.
+    if (address >= ADDRESS_4B) {
+        buf[0] = inst_4b;
+        buf[1] = address >> 24;
+        buf[2] = address >> 16;
+        buf[3] = address >> 8;
+        buf[4] = address;
+        return 5;
+    }
+
+    buf[0] = inst;
+    buf[1] = address >> 16;
+    buf[2] = address >> 8;
+    buf[3] = address;
+    return 4;
+}
+
+
+static bool
+read_chunk(uint32_t address, uint32_t len)
+{
+    uint8_t header_len = address >= ADDRESS_4B ? 5 : 4;
+    uint8_t *buf = spi_lock(len + header_len);
+    if (buf == NULL)
+        return false;
+
+    read_header_len = put_address(buf, READ, READ_4B, address);
+    instruction = READ;
+    return spi_start_transfer();
+}
+
+
+static bool
+step_run(void)
+{
+    uint8_t *buf;
+
+    switch (sequence->steps[step]) {
+    case STEP_END: {
+            const sequence_t *seq = sequence;
+            sequence = NULL;
+            staged_buf = NULL;
+            staged_len = 0;
+            seq->complete(sequence_ok);
         }
+        return true;
+
+    case STEP_WRITE_ENABLE:
+        if ((buf = spi_lock(1)) == NULL)
+            return false;
+        buf[0] = instruction = WRITE_ENABLE;
+        return spi_start_transfer();
 
-        memcpy(buf, flash_buf, flash_buf_locked_len);
-        instruction = buf[0];
-        spi_start_transfer();
+    case STEP_WAIT_WEL:
+    case STEP_WAIT_READY:
+        timer_start(true);
+        return true;
+
+    case STEP_COMMAND:
+        if (!spi_lock_buffer(staged_buf, staged_len))
+            return false;
+        instruction = staged_instruction;
+        return spi_start_transfer();
+
+    case STEP_VERIFY:
+        return read_chunk(write_address, SPI_FLASH_PAGE_SIZE);
+
+    case STEP_CRC:
+        if (crc_remaining == 0) {
+            sequence_next();
+            return true;
+        }
+        return read_chunk(crc_address, crc_remaining > SPI_FLASH_PAGE_SIZE ? SPI_FLASH_PAGE_SIZE : crc_remaining);
+
+    case STEP_SRAM_RESET:
+        // iCE40 selects SPI slave configuration if chip select is low when
+        // CRESET is released.
+        spi_hold_cs(true);
+        sram_ticks = SRAM_RESET_TICKS;
+        timer_start(false);
         return true;
     }
+    return false;
+}
+
 
-    if (start_write_verify) {
-        start_write_verify = false;
-        waiting_write_verify = true;
-        spi_flash_read(flash_buf[1], flash_buf[2], flash_buf[3]);
+bool
+spi_flash_task(void)
+{
+    // a step blocked by the spi lock is retried on dma completion, or when
+    // the read buffer is released.
+    event_take(EVENT_FLASH);
+
+    if (step_pending && sequence != NULL && !spi_is_locked()) {
+        if (step_run())
+            step_pending = false;
         return true;
     }
 
-    if ((TIM3->SR & TIM_SR_UIF) == TIM_SR_UIF) {
-        TIM3->SR &= ~TIM_SR_UIF;
+    if (event_take(EVENT_TIMER)) {
+        if (sram_ticks != 0) {
+            if (--sram_ticks == SRAM_RESET_TICKS - 1)
+                GPIOB->BSRR = GPIO_BSRR_BS_0;
+
+            if (sram_ticks == 0) {
+                timer_stop();
+                sequence_next();
+            }
+            return true;
+        }
+
         spi_flash_status();
         return true;
     }
@@ -112,104 +365,109 @@ spi_flash_task(void)
 }
 
 
-bool
-spi_flash_read(uint8_t addr0, uint8_t addr1, uint8_t addr2)
+static bool
+stage(const sequence_t *seq, instruction_t inst, uint8_t *buf, uint32_t len)
 {
-    uint8_t *buf = spi_lock(SPI_FLASH_PAGE_SIZE + 4);
-    if (buf == NULL)
+    if (sequence != NULL)
         return false;
 
-    buf[0] = instruction = READ;
-    buf[1] = addr0;
-    buf[2] = addr1;
-    buf[3] = addr2;
-    return spi_start_transfer();
+    staged_instruction = inst;
+    staged_buf = buf;
+    staged_len = len;
+    return sequence_start(seq);
 }
 
 
-bool
-spi_flash_write(uint8_t addr0, uint8_t addr1, uint8_t addr2, const uint8_t *data, uint32_t data_len)
+static bool
+stage_address(const sequence_t *seq, instruction_t inst, instruction_t inst_4b, uint32_t address)
 {
-    if (flash_buf_locked_len != 0)
+    if (sequence != NULL)
         return false;
 
-    uint8_t *buf = spi_lock(1);
-    if (buf == NULL)
-        return false;
+    return stage(seq, inst, command_buf, put_address(command_buf, inst, inst_4b, address));
+}
 
-    flash_buf_locked_len = SPI_BUFFER_SIZE;
-    flash_buf[0] = WRITE;
-    flash_buf[1] = addr0;
-    flash_buf[2] = addr1;
-    flash_buf[3] = addr2;
-    memcpy(flash_buf + 4, data, data_len);
 
-    waiting_wel_write = true;
-    buf[0] = instruction = WRITE_ENABLE;
-    return spi_start_transfer();
+static bool
+stage_command(const sequence_t *seq, instruction_t inst)
+{
+    if (sequence != NULL)
+        return false;
+
+    command_buf[0] = inst;
+    return stage(seq, inst, command_buf, 1);
 }
 
 
 bool
-spi_flash_erase_sector(uint8_t addr0, uint8_t addr1, uint8_t addr2)
+spi_flash_read(uint32_t address)
 {
-    if (flash_buf_locked_len != 0)
+    if (sequence != NULL)
         return false;
 
-    uint8_t *buf = spi_lock(1);
-    if (buf == NULL)
+    return read_chunk(address, SPI_FLASH_PAGE_SIZE);
+}
+
+
+bool
+spi_flash_write(uint8_t *page, bool verify)
+{
+    if (sequence != NULL)
         return false;
 
-    flash_buf_locked_len = 4;
-    flash_buf[0] = ERASE_SECTOR;
-    flash_buf[1] = addr0;
-    flash_buf[2] = addr1;
-    flash_buf[3] = addr2;
+    // the page is sent in place, and overwritten by the received data, so
+    // the CRC for the verify step is calculated before.
+    write_address = (page[1] << 24) | (page[2] << 16) | (page[3] << 8) | page[4];
+    if (verify) {
+        crc_reset();
+        crc_update(page + 5, SPI_FLASH_PAGE_SIZE);
+        write_crc = crc_get();
+    }
 
-    waiting_wel_erase_sector = true;
-    buf[0] = instruction = WRITE_ENABLE;
-    return spi_start_transfer();
+    const sequence_t *seq = verify ? &sequence_write : &sequence_write_noverify;
+
+    // for 3-byte addresses the instruction replaces the unused most
+    // significant address byte.
+    if (write_address >= ADDRESS_4B) {
+        page[0] = WRITE_4B;
+        return stage(seq, WRITE, page, SPI_FLASH_PAGE_SIZE + 5);
+    }
+    page[1] = WRITE;
+    return stage(seq, WRITE, page + 1, SPI_FLASH_PAGE_SIZE + 4);
 }
 
 
 bool
-spi_flash_erase_block(uint8_t addr0, uint8_t addr1, uint8_t addr2)
+spi_flash_erase_sector(uint32_t address)
 {
-    if (flash_buf_locked_len != 0)
-        return false;
-
-    uint8_t *buf = spi_lock(1);
-    if (buf == NULL)
-        return false;
+    return stage_address(&sequence_erase_sector, ERASE_SECTOR, ERASE_SECTOR_4B, address);
+}
 
-    flash_buf_locked_len = 4;
-    flash_buf[0] = ERASE_BLOCK;
-    flash_buf[1] = addr0;
-    flash_buf[2] = addr1;
-    flash_buf[3] = addr2;
 
-    waiting_wel_erase_block = true;
-    buf[0] = instruction = WRITE_ENABLE;
-    return spi_start_transfer();
+bool
+spi_flash_erase_block(uint32_t address)
+{
+    return stage_address(&sequence_erase_block, ERASE_BLOCK, ERASE_BLOCK_4B, address);
 }
 
 
 bool
 spi_flash_erase_chip(void)
 {
-    if (flash_buf_locked_len != 0)
-        return false;
+    return stage_command(&sequence_erase_chip, ERASE_CHIP);
+}
 
-    uint8_t *buf = spi_lock(1);
-    if (buf == NULL)
-        return false;
 
-    flash_buf_locked_len = 1;
-    flash_buf[0] = ERASE_CHIP;
+bool
+spi_flash_crc(uint32_t address, uint32_t len)
+{
+    if (sequence != NULL)
+        return false;
 
-    waiting_wel_erase_chip = true;
-    buf[0] = instruction = WRITE_ENABLE;
-    return spi_start_transfer();
+    // the CRC unit is not reset here, so ranges can be accumulated
+    crc_address = address;
+    crc_remaining = len;
+    return sequence_start(&sequence_crc);
 }
 
 
@@ -267,98 +525,117 @@ spi_flash_powerdown(void)
 }
 
 
+bool
+spi_flash_sram_start(void)
+{
+    // the flash shares chip select with the FPGA, put it in deep power-down
+    // so that it ignores the bitstream.
+    return stage_command(&sequence_sram_start, POWER_DOWN);
+}
+
+
+bool
+spi_flash_sram_write(uint8_t *data, uint32_t data_len)
+{
+    if (!spi_lock_buffer(data, data_len))
+        return false;
+
+    instruction = SRAM_DATA;
+    return spi_start_transfer();
+}
+
+
+bool
+spi_flash_sram_finish(void)
+{
+    uint8_t *buf = spi_lock(SRAM_DUMMY_BYTES);
+    if (buf == NULL)
+        return false;
+
+    memset(buf, 0, SRAM_DUMMY_BYTES);
+    instruction = SRAM_FINISH;
+    return spi_start_transfer();
+}
+
+
 bool
 spi_flash_is_locked(void)
 {
-    return spi_is_locked() || flash_buf_locked_len != 0;
+    return spi_is_locked() || sequence != NULL;
+}
+
+
+void
+spi_flash_read_release(void)
+{
+    spi_unlock();
+    if (step_pending)
+        event_post(EVENT_FLASH);
 }
 
 
 void
-spi_transfer_complete_cb(const uint8_t *buf, uint32_t buf_len)
+spi_transfer_complete_cb(uint8_t *buf, uint32_t buf_len)
 {
     if (buf_len == 0)
         return;
 
-    switch (instruction) {
-    case WRITE:
-        break;
+    step_t current = sequence != NULL ? sequence->steps[step] : STEP_END;
 
+    switch (instruction) {
     case READ:
-        if (waiting_write_verify) {
-            bool verified = true;
-            for (uint16_t i = 4; i < (SPI_FLASH_PAGE_SIZE + 4); i++) {
-                if (flash_buf[i] != buf[i]) {
-                    verified = false;
-                    break;
-                }
-            }
+        if (current == STEP_VERIFY) {
+            crc_reset();
+            crc_update(buf + read_header_len, SPI_FLASH_PAGE_SIZE);
+            if (crc_get() != write_crc)
+                sequence_ok = false;
+            sequence_next();
+            break;
+        }
 
-            spi_flash_write_cb(verified);
-            waiting_write_verify = false;
-            flash_buf_locked_len = 0;
+        if (current == STEP_CRC) {
+            crc_update(buf + read_header_len, buf_len - read_header_len);
+            crc_address += buf_len - read_header_len;
+            crc_remaining -= buf_len - read_header_len;
+            step_pending = true;
+            event_post(EVENT_FLASH);
             break;
         }
 
-        spi_flash_read_cb(buf + 4, buf_len - 4);
+        // the data is handed over without copies, and stays locked until
+        // spi_flash_read_release.
+        spi_hold_buffer();
+        spi_flash_read_cb(buf + read_header_len, buf_len - read_header_len);
         break;
 
     case STATUS:
-        if (waiting_wel_erase_sector && (buf[1] & (1 << 1))) {
-            waiting_wel_erase_sector = false;
-            start_erase_sector = true;
-            break;
-        }
-        if (waiting_wel_erase_block && (buf[1] & (1 << 1))) {
-            waiting_wel_erase_block = false;
-            start_erase_block = true;
-            break;
-        }
-        if (waiting_wel_erase_chip && (buf[1] & (1 << 1))) {
-            waiting_wel_erase_chip = false;
-            start_erase_chip = true;
-            break;
-        }
-        if (waiting_wel_write && (buf[1] & (1 << 1))) {
-            waiting_wel_write = false;
-            start_write = true;
-            break;
-        }
-        if (waiting_erase_sector && ((buf[1] & (1 << 0)) == 0)) {
-            waiting_erase_sector = false;
-            TIM3->CR1 &= ~TIM_CR1_CEN;
-            spi_flash_erase_sector_cb();
-            flash_buf_locked_len = 0;
-            break;
-        }
-        if (waiting_erase_block && ((buf[1] & (1 << 0)) == 0)) {
-            waiting_erase_block = false;
-            TIM3->CR1 &= ~TIM_CR1_CEN;
-            spi_flash_erase_block_cb();
-            flash_buf_locked_len = 0;
-            break;
-        }
-        if (waiting_erase_chip && ((buf[1] & (1 << 0)) == 0)) {
-            waiting_erase_chip = false;
-            TIM3->CR1 &= ~TIM_CR1_CEN;
-            spi_flash_erase_chip_cb();
-            flash_buf_locked_len = 0;
+        spi_flash_status_cb(buf[1]);
+
+        if (current == STEP_WAIT_WEL && (buf[1] & STATUS_WEL)) {
+            timer_stop();
+            sequence_next();
             break;
         }
-        if (waiting_write && ((buf[1] & (1 << 0)) == 0)) {
-            waiting_write = false;
-            start_write_verify = true;
-            TIM3->CR1 &= ~TIM_CR1_CEN;
+        if (current == STEP_WAIT_READY && (buf[1] & STATUS_WIP) == 0) {
+            timer_stop();
+            sequence_next();
             break;
         }
         break;
 
-    case WRITE_ENABLE:
-        TIM3->EGR = TIM_EGR_UG;
-        TIM3->CR1 |= TIM_CR1_CEN;
+    case WRITE:
+        if (current == STEP_COMMAND) {
+            spi_flash_page_release_cb();
+            sequence_next();
+        }
         break;
 
+    case WRITE_ENABLE:
     case ERASE_SECTOR:
+    case ERASE_BLOCK:
+    case ERASE_CHIP:
+        if (current == STEP_WRITE_ENABLE || current == STEP_COMMAND)
+            sequence_next();
         break;
 
     case JEDEC_ID:
@@ -370,12 +647,28 @@ spi_transfer_complete_cb(const uint8_t *buf, uint32_t buf_len)
         break;
 
     case POWER_DOWN:
+        if (current == STEP_COMMAND) {
+            sequence_next();
+            break;
+        }
         GPIOB->BSRR = GPIO_BSRR_BS_0;
         spi_flash_powerdown_cb();
         break;
 
-    case ERASE_CHIP:
-    case ERASE_BLOCK:
+    case SRAM_DATA:
+        spi_flash_sram_write_cb();
+        break;
+
+    case SRAM_FINISH:
+        spi_hold_cs(false);
+        spi_flash_sram_finish_cb();
+        break;
+
+    case READ_4B:
+    case WRITE_4B:
+    case ERASE_SECTOR_4B:
+    case ERASE_BLOCK_4B:
+        // only sent to the flash, instruction holds the 3-byte variant
         break;
     }
 }
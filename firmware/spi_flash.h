@@ -11,24 +11,41 @@
 void spi_flash_init(void);
 bool spi_flash_task(void);
 
-bool spi_flash_read(uint8_t addr0, uint8_t addr1, uint8_t addr2);
-bool spi_flash_write(uint8_t addr0, uint8_t addr1, uint8_t addr2, const uint8_t *data, uint32_t data_len);
-bool spi_flash_erase_sector(uint8_t addr0, uint8_t addr1, uint8_t addr2);
-bool spi_flash_erase_block(uint8_t addr0, uint8_t addr1, uint8_t addr2);
+bool spi_flash_read(uint32_t address);
+void spi_flash_read_release(void);
+
+// page is SPI_FLASH_PAGE_SIZE + 5 bytes, with the 4-byte address (big endian)
+// in bytes 1-4. it is owned by the flash layer until spi_flash_page_release_cb.
+bool spi_flash_write(uint8_t *page, bool verify);
+bool spi_flash_erase_sector(uint32_t address);
+bool spi_flash_erase_block(uint32_t address);
 bool spi_flash_erase_chip(void);
+bool spi_flash_crc(uint32_t address, uint32_t len);
 bool spi_flash_status(void);
 bool spi_flash_jedec_id(void);
 bool spi_flash_powerup(void);
 bool spi_flash_powerdown(void);
 bool spi_flash_is_locked(void);
 
+bool spi_flash_sram_start(void);
+bool spi_flash_sram_write(uint8_t *data, uint32_t data_len);
+bool spi_flash_sram_finish(void);
+
 // callbacks
 void spi_flash_erase_sector_cb(void);
 void spi_flash_erase_block_cb(void);
 void spi_flash_erase_chip_cb(void);
 void spi_flash_write_cb(bool verified);
-void spi_flash_read_cb(const uint8_t *buf, uint32_t len);
+void spi_flash_page_release_cb(void);
+
+// buf[-1] may be overwritten, and the data is valid until
+// spi_flash_read_release.
+void spi_flash_read_cb(uint8_t *buf, uint32_t len);
+void spi_flash_crc_cb(uint32_t crc);
 void spi_flash_status_cb(uint8_t status);
 void spi_flash_jedec_id_cb(uint8_t manufacturer_id, uint16_t device_id);
 void spi_flash_powerup_cb(void);
 void spi_flash_powerdown_cb(void);
+void spi_flash_sram_start_cb(void);
+void spi_flash_sram_write_cb(void);
+void spi_flash_sram_finish_cb(void);
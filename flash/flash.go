@@ -0,0 +1,452 @@
+package flash
+
+import (
+	"bytes"
+	"container/list"
+	"errors"
+	"io"
+	"slices"
+	"sync"
+
+	"rafaelmartins.com/p/iceflashprog/internal/device"
+	"rafaelmartins.com/p/iceflashprog/internal/plan"
+)
+
+const (
+	PageSize   = device.FlashPageSize
+	SectorSize = device.FlashSectorSize
+	BlockSize  = device.FlashBlockSize
+
+	// DefaultCachePages is the number of pages kept by the read cache.
+	DefaultCachePages = 4096
+)
+
+var (
+	ErrOutOfRange = errors.New("iceflashprog: flash: out of range")
+	ErrClosed     = errors.New("iceflashprog: flash: closed")
+)
+
+// Devices returns the serial numbers of the programmers connected to the
+// host.
+func Devices() ([]string, error) {
+	devices, err := device.List()
+	if err != nil {
+		return nil, err
+	}
+
+	rv := []string{}
+	for _, dev := range devices {
+		rv = append(rv, dev.SerialNumber())
+	}
+	return rv, nil
+}
+
+// sector is an erase sector with pending writes, that only holds the bytes
+// written to it until it is synced.
+type sector struct {
+	data    [SectorSize]byte
+	written [SectorSize]bool
+}
+
+type cachedPage struct {
+	addr uint32
+	data []byte
+}
+
+// Flash is the flash memory connected to a programmer. Reads go through a
+// page cache and writes are kept in memory, per erase sector, until Sync:
+// small and unaligned writes are then merged with the current content and
+// written as whole pages, erasing only the sectors where bits must be set,
+// with contiguous sectors erased together.
+//
+// It is safe for concurrent use.
+type Flash struct {
+	m      sync.Mutex
+	dev    *device.Device
+	mfr    byte
+	devid  uint16
+	size   uint32
+	closed bool
+
+	cachePages int
+	cache      map[uint32]*list.Element
+	lru        *list.List
+
+	dirty map[uint32]*sector
+}
+
+// Open opens the programmer with the given serial number, or the only one
+// connected if empty, and powers up its flash memory.
+func Open(serialNumber string) (*Flash, error) {
+	dev, err := device.New(serialNumber)
+	if err != nil {
+		return nil, err
+	}
+	if err := dev.Open(); err != nil {
+		return nil, err
+	}
+
+	rv := &Flash{
+		dev:        dev,
+		cachePages: DefaultCachePages,
+		cache:      map[uint32]*list.Element{},
+		lru:        list.New(),
+		dirty:      map[uint32]*sector{},
+	}
+
+	// a disconnected device fails the calls waiting for a response.
+	go dev.Listen()
+
+	if err := rv.init(); err != nil {
+		dev.Close()
+		return nil, err
+	}
+	return rv, nil
+}
+
+func (f *Flash) init() error {
+	if _, err := f.dev.GetCapabilities(); err != nil {
+		return err
+	}
+	if err := f.dev.PowerUp(); err != nil {
+		return err
+	}
+
+	var err error
+	f.mfr, f.devid, err = f.dev.GetJedecId()
+	if err != nil {
+		return err
+	}
+	f.size = f.dev.FlashSize()
+	return nil
+}
+
+// SetCachePages changes the number of pages kept by the read cache. Zero
+// disables it.
+func (f *Flash) SetCachePages(n int) {
+	f.m.Lock()
+	defer f.m.Unlock()
+
+	f.cachePages = max(n, 0)
+	f.trimCache()
+}
+
+// SerialNumber returns the serial number of the programmer.
+func (f *Flash) SerialNumber() string {
+	return f.dev.SerialNumber()
+}
+
+// JedecId returns the manufacturer and device IDs of the flash memory.
+func (f *Flash) JedecId() (byte, uint16) {
+	return f.mfr, f.devid
+}
+
+// Size returns the size of the flash memory, in bytes.
+func (f *Flash) Size() int64 {
+	return int64(f.size)
+}
+
+func (f *Flash) trimCache() {
+	for f.lru.Len() > f.cachePages {
+		e := f.lru.Back()
+		f.lru.Remove(e)
+		delete(f.cache, e.Value.(*cachedPage).addr)
+	}
+}
+
+func (f *Flash) cachePage(addr uint32, data []byte) {
+	if f.cachePages == 0 {
+		return
+	}
+	if e, ok := f.cache[addr]; ok {
+		e.Value.(*cachedPage).data = data
+		f.lru.MoveToFront(e)
+		return
+	}
+	f.cache[addr] = f.lru.PushFront(&cachedPage{addr: addr, data: data})
+	f.trimCache()
+}
+
+// page returns the content of a flash page, without pending writes. The
+// returned slice must not be modified.
+func (f *Flash) page(addr uint32) ([]byte, error) {
+	if e, ok := f.cache[addr]; ok {
+		f.lru.MoveToFront(e)
+		return e.Value.(*cachedPage).data, nil
+	}
+
+	data, err := f.dev.ReadFlashPage(addr)
+	if err != nil {
+		return nil, err
+	}
+	f.cachePage(addr, data)
+	return data, nil
+}
+
+func (f *Flash) check(off int64) error {
+	if f.closed {
+		return ErrClosed
+	}
+	if off < 0 || off > int64(f.size) {
+		return ErrOutOfRange
+	}
+	return nil
+}
+
+// ReadAt reads from the flash memory, including the writes not synced yet.
+func (f *Flash) ReadAt(p []byte, off int64) (int, error) {
+	f.m.Lock()
+	defer f.m.Unlock()
+
+	if err := f.check(off); err != nil {
+		return 0, err
+	}
+
+	n := 0
+	for n < len(p) && off+int64(n) < int64(f.size) {
+		addr := uint32(off) + uint32(n)
+		page := addr &^ (PageSize - 1)
+
+		data, err := f.page(page)
+		if err != nil {
+			return n, err
+		}
+		c := copy(p[n:], data[addr-page:])
+
+		if s, ok := f.dirty[addr&^(SectorSize-1)]; ok {
+			base := addr & (SectorSize - 1)
+			for i := 0; i < c; i++ {
+				if s.written[base+uint32(i)] {
+					p[n+i] = s.data[base+uint32(i)]
+				}
+			}
+		}
+		n += c
+	}
+
+	if n < len(p) {
+		return n, io.EOF
+	}
+	return n, nil
+}
+
+// WriteAt stores the data to be written to the flash memory by the next
+// Sync. Writes past the end of the flash memory fail without writing
+// anything.
+func (f *Flash) WriteAt(p []byte, off int64) (int, error) {
+	f.m.Lock()
+	defer f.m.Unlock()
+
+	if err := f.check(off); err != nil {
+		return 0, err
+	}
+	if off+int64(len(p)) > int64(f.size) {
+		return 0, ErrOutOfRange
+	}
+
+	for n := 0; n < len(p); {
+		addr := uint32(off) + uint32(n)
+		base := addr & (SectorSize - 1)
+
+		s, ok := f.dirty[addr-base]
+		if !ok {
+			s = &sector{}
+			f.dirty[addr-base] = s
+		}
+
+		c := copy(s.data[base:], p[n:])
+		for i := base; i < base+uint32(c); i++ {
+			s.written[i] = true
+		}
+		n += c
+	}
+	return len(p), nil
+}
+
+// merge returns the current content of the sector and the content it must
+// have after the pending writes.
+func (f *Flash) merge(addr uint32, s *sector) ([]byte, []byte, error) {
+	cur := make([]byte, 0, SectorSize)
+	for page := addr; page < addr+SectorSize; page += PageSize {
+		data, err := f.page(page)
+		if err != nil {
+			return nil, nil, err
+		}
+		cur = append(cur, data...)
+	}
+
+	next := slices.Clone(cur)
+	for i, w := range s.written {
+		if w {
+			next[i] = s.data[i]
+		}
+	}
+	return cur, next, nil
+}
+
+// needsErase returns true if programming next over cur would need to set
+// bits, that only an erase can do.
+func needsErase(cur []byte, next []byte) bool {
+	for i := range cur {
+		if cur[i]&next[i] != next[i] {
+			return true
+		}
+	}
+	return false
+}
+
+// Sync writes the pending writes to the flash memory.
+func (f *Flash) Sync() error {
+	f.m.Lock()
+	defer f.m.Unlock()
+
+	if f.closed {
+		return ErrClosed
+	}
+
+	// a failed sync may have erased cached pages, the pending writes are
+	// kept to be retried.
+	if err := f.sync(); err != nil {
+		clear(f.cache)
+		f.lru.Init()
+		return err
+	}
+	clear(f.dirty)
+	return nil
+}
+
+// update is a sector that changes with the pending writes.
+type update struct {
+	addr  uint32
+	cur   []byte
+	next  []byte
+	erase bool
+}
+
+// syncSteps returns the job steps that write the updates, in address order.
+// Contiguous sectors are erased together, with block erases where possible.
+// Erased sectors only need the pages that are not blank, others only the
+// pages that changed, and contiguous pages are programmed by the same step.
+func syncSteps(updates []*update) []plan.Step {
+	rv := []plan.Step{}
+
+	var start, end uint32
+	flush := func() {
+		for _, s := range plan.EraseSteps(start, end-start) {
+			rv = append(rv, plan.Step{JobStep: s})
+		}
+		start, end = 0, 0
+	}
+	for _, u := range updates {
+		if !u.erase {
+			continue
+		}
+		if start != end && u.addr != end {
+			flush()
+		}
+		if start == end {
+			start = u.addr
+		}
+		end = u.addr + SectorSize
+	}
+	flush()
+
+	for _, u := range updates {
+		var r *plan.Region
+		for off := uint32(0); off < SectorSize; off += PageSize {
+			cur, next := u.cur[off:off+PageSize], u.next[off:off+PageSize]
+			if u.erase && bytes.Equal(next, erasedPage) || !u.erase && bytes.Equal(cur, next) {
+				r = nil
+				continue
+			}
+
+			if r != nil {
+				r.Data = u.next[r.Address-u.addr : off+PageSize]
+				rv[len(rv)-1].Length += PageSize
+				continue
+			}
+
+			r = &plan.Region{
+				Name:    "sync",
+				Address: u.addr + off,
+				Data:    next,
+				Verify:  plan.VerifyPage,
+			}
+			rv = append(rv, plan.Step{
+				JobStep: device.JobStep{
+					Op:      device.JobProgram,
+					Address: r.Address,
+					Length:  PageSize,
+				},
+				Region: r,
+			})
+		}
+	}
+	return rv
+}
+
+func (f *Flash) sync() error {
+	addrs := []uint32{}
+	for addr := range f.dirty {
+		addrs = append(addrs, addr)
+	}
+	slices.Sort(addrs)
+
+	updates := []*update{}
+	for _, addr := range addrs {
+		cur, next, err := f.merge(addr, f.dirty[addr])
+		if err != nil {
+			return err
+		}
+		if !bytes.Equal(cur, next) {
+			updates = append(updates, &update{addr: addr, cur: cur, next: next, erase: needsErase(cur, next)})
+		}
+	}
+
+	// the steps run as device jobs, or as individual requests for firmware
+	// without them.
+	for steps := syncSteps(updates); len(steps) > 0; {
+		n := min(len(steps), device.JobMaxSteps)
+		if _, _, err := plan.Run(f.dev, plan.Job(steps[:n]), nil); err != nil {
+			return err
+		}
+		steps = steps[n:]
+	}
+
+	for _, u := range updates {
+		for off := uint32(0); off < SectorSize; off += PageSize {
+			f.cachePage(u.addr+off, u.next[off:off+PageSize])
+		}
+	}
+	return nil
+}
+
+var erasedPage = bytes.Repeat([]byte{0xff}, PageSize)
+
+// Invalidate drops the read cache, for when the flash memory was changed by
+// something else.
+func (f *Flash) Invalidate() {
+	f.m.Lock()
+	defer f.m.Unlock()
+
+	clear(f.cache)
+	f.lru.Init()
+}
+
+// Close syncs the pending writes, powers down the flash memory and closes
+// the programmer.
+func (f *Flash) Close() error {
+	err := f.Sync()
+	if errors.Is(err, ErrClosed) {
+		return err
+	}
+
+	f.m.Lock()
+	defer f.m.Unlock()
+
+	f.closed = true
+	if cerr := f.dev.Close(); err == nil {
+		err = cerr
+	}
+	return err
+}
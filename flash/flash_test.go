@@ -0,0 +1,209 @@
+package flash
+
+import (
+	"bytes"
+	"container/list"
+	"errors"
+	"io"
+	"testing"
+
+	"rafaelmartins.com/p/iceflashprog/internal/device"
+)
+
+const testSize = 4 * SectorSize
+
+// newTestFlash returns a flash with every page in the read cache, so that
+// no device is needed.
+func newTestFlash(t *testing.T) (*Flash, []byte) {
+	f := &Flash{
+		size:       testSize,
+		cachePages: testSize / PageSize,
+		cache:      map[uint32]*list.Element{},
+		lru:        list.New(),
+		dirty:      map[uint32]*sector{},
+	}
+
+	content := make([]byte, testSize)
+	for i := range content {
+		content[i] = byte(i * 7)
+	}
+	for addr := uint32(0); addr < testSize; addr += PageSize {
+		f.cachePage(addr, content[addr:addr+PageSize])
+	}
+	return f, content
+}
+
+func TestCacheLRU(t *testing.T) {
+	f, _ := newTestFlash(t)
+	f.SetCachePages(3)
+
+	if f.lru.Len() != 3 || len(f.cache) != 3 {
+		t.Fatalf("invalid cache size: %d", f.lru.Len())
+	}
+
+	// the most recently added pages are kept.
+	last := uint32(testSize - PageSize)
+	for _, addr := range []uint32{last, last - PageSize, last - 2*PageSize} {
+		if _, ok := f.cache[addr]; !ok {
+			t.Fatalf("page not cached: %#x", addr)
+		}
+	}
+
+	// a cache hit moves the page to the front, so the next page added
+	// evicts the least recently used one.
+	if _, err := f.page(last - 2*PageSize); err != nil {
+		t.Fatal(err)
+	}
+	f.cachePage(0, make([]byte, PageSize))
+	if _, ok := f.cache[last-PageSize]; ok {
+		t.Fatal("least recently used page not evicted")
+	}
+	if _, ok := f.cache[last-2*PageSize]; !ok {
+		t.Fatal("recently used page evicted")
+	}
+
+	// updating a cached page does not grow the cache.
+	f.cachePage(0, bytes.Repeat([]byte{1}, PageSize))
+	if f.lru.Len() != 3 || f.cache[0].Value.(*cachedPage).data[0] != 1 {
+		t.Fatal("invalid cache update")
+	}
+
+	f.SetCachePages(0)
+	if f.lru.Len() != 0 || len(f.cache) != 0 {
+		t.Fatal("cache not disabled")
+	}
+	f.cachePage(0, make([]byte, PageSize))
+	if f.lru.Len() != 0 {
+		t.Fatal("page cached while disabled")
+	}
+}
+
+func TestReadAtPageBoundaries(t *testing.T) {
+	f, content := newTestFlash(t)
+
+	for _, tc := range []struct {
+		off int64
+		len int
+	}{
+		{0, 1},
+		{PageSize - 1, 2},
+		{PageSize - 1, PageSize + 2},
+		{SectorSize - 3, 3*PageSize + 5},
+		{testSize - PageSize, PageSize},
+	} {
+		p := make([]byte, tc.len)
+		n, err := f.ReadAt(p, tc.off)
+		if err != nil || n != tc.len {
+			t.Fatalf("%#x+%d: %d, %v", tc.off, tc.len, n, err)
+		}
+		if !bytes.Equal(p, content[tc.off:tc.off+int64(tc.len)]) {
+			t.Fatalf("%#x+%d: invalid data", tc.off, tc.len)
+		}
+	}
+
+	p := make([]byte, 10)
+	if n, err := f.ReadAt(p, testSize-4); n != 4 || err != io.EOF {
+		t.Fatalf("short read: %d, %v", n, err)
+	}
+	if _, err := f.ReadAt(p, testSize+1); !errors.Is(err, ErrOutOfRange) {
+		t.Fatalf("expected out of range, got %v", err)
+	}
+	if _, err := f.ReadAt(p, -1); !errors.Is(err, ErrOutOfRange) {
+		t.Fatalf("expected out of range, got %v", err)
+	}
+}
+
+func TestWriteAtPageBoundaries(t *testing.T) {
+	f, content := newTestFlash(t)
+	expected := bytes.Clone(content)
+
+	for _, tc := range []struct {
+		off int64
+		len int
+	}{
+		{PageSize - 1, 2},
+		{SectorSize - PageSize - 3, PageSize + 6},
+		{2*SectorSize - 1, SectorSize + 2},
+	} {
+		p := bytes.Repeat([]byte{byte(tc.off)}, tc.len)
+		if n, err := f.WriteAt(p, tc.off); err != nil || n != tc.len {
+			t.Fatalf("%#x+%d: %d, %v", tc.off, tc.len, n, err)
+		}
+		copy(expected[tc.off:], p)
+	}
+
+	// sectors are tracked separately, including the ones fully written.
+	if len(f.dirty) != 4 {
+		t.Fatalf("invalid dirty sectors: %d", len(f.dirty))
+	}
+
+	// reads include the writes not synced yet, and not the cached content.
+	p := make([]byte, testSize)
+	if n, err := f.ReadAt(p, 0); err != nil || n != testSize {
+		t.Fatalf("read: %d, %v", n, err)
+	}
+	if !bytes.Equal(p, expected) {
+		t.Fatal("pending writes not read back")
+	}
+	if !bytes.Equal(f.cache[0].Value.(*cachedPage).data, content[:PageSize]) {
+		t.Fatal("cached page changed by pending write")
+	}
+
+	if n, err := f.WriteAt(make([]byte, 2), testSize-1); n != 0 || !errors.Is(err, ErrOutOfRange) {
+		t.Fatalf("expected out of range, got %d, %v", n, err)
+	}
+	if _, err := f.WriteAt(nil, testSize+1); !errors.Is(err, ErrOutOfRange) {
+		t.Fatalf("expected out of range, got %v", err)
+	}
+}
+
+func TestSyncSteps(t *testing.T) {
+	blank := bytes.Repeat([]byte{0xff}, SectorSize)
+	zeros := make([]byte, SectorSize)
+
+	// a sector written with zeros only needs to program its changed pages,
+	// two contiguous erased sectors are erased together and only program
+	// their pages that are not blank.
+	next := bytes.Clone(blank)
+	next[PageSize] = 0
+	next[2*PageSize] = 0
+	erased := bytes.Clone(blank)
+	erased[3*PageSize] = 0
+
+	updates := []*update{
+		{addr: 0, cur: blank, next: next},
+		{addr: SectorSize, cur: zeros, next: erased, erase: true},
+		{addr: 2 * SectorSize, cur: zeros, next: blank, erase: true},
+	}
+
+	want := []device.JobStep{
+		{Op: device.JobEraseSector, Address: SectorSize, Length: 2 * SectorSize},
+		{Op: device.JobProgram, Address: PageSize, Length: 2 * PageSize},
+		{Op: device.JobProgram, Address: SectorSize + 3*PageSize, Length: PageSize},
+	}
+
+	steps := syncSteps(updates)
+	if len(steps) != len(want) {
+		t.Fatalf("invalid steps: %+v", steps)
+	}
+	for i, s := range steps {
+		if s.JobStep != want[i] {
+			t.Fatalf("invalid step %d: %+v", i, s.JobStep)
+		}
+		if s.Region != nil && (s.Region.Address != s.Address || uint32(len(s.Region.Data)) != s.Length) {
+			t.Fatalf("invalid region for step %d: %#x, %d bytes", i, s.Region.Address, len(s.Region.Data))
+		}
+	}
+	if !bytes.Equal(steps[1].Region.Data, next[PageSize:3*PageSize]) {
+		t.Fatal("invalid program data")
+	}
+}
+
+func TestNeedsErase(t *testing.T) {
+	if needsErase([]byte{0xff, 0x0f}, []byte{0x0f, 0x0f}) {
+		t.Fatal("clearing bits must not need an erase")
+	}
+	if !needsErase([]byte{0x00}, []byte{0x01}) {
+		t.Fatal("setting bits must need an erase")
+	}
+}
@@ -1,54 +1,210 @@
 package bitstream
 
 import (
+	"bufio"
+	"bytes"
+	"compress/gzip"
+	"errors"
+	"hash"
+	"hash/crc32"
 	"io"
 	"os"
 
 	"rafaelmartins.com/p/iceflashprog/internal/device"
 )
 
+var ErrStreamConsumed = errors.New("iceflashprog: bitstream: input stream already consumed")
+
+// streamQueuePages is the amount of pages read ahead from streaming inputs,
+// while the previous ones are being written.
+const streamQueuePages = device.FlashBlockSize / device.FlashPageSize
+
+var gzipMagic = []byte{0x1f, 0x8b}
+
 type Bitstream struct {
-	file string
-	fp   *os.File
-	size int64
-	buf  []byte
+	file   string
+	data   []byte
+	sparse *sparseDump
+
+	// streaming input (stdin, pipes), consumed only once.
+	fp       *os.File
+	stream   io.Reader
+	consumed bool
+	read     uint32
+	hash     hash.Hash32
 }
 
+// New opens a bitstream. Pipes and the standard input ("-") are streamed,
+// and decompressed while written if gzip compressed. Compressed files are
+// decompressed into memory. Only the extents of sparse flash dumps are kept.
 func New(file string) (*Bitstream, error) {
+	if file == "-" {
+		return newStream(file, os.Stdin, os.Stdin)
+	}
+
 	fp, err := os.Open(file)
 	if err != nil {
 		return nil, err
 	}
 
-	size, err := fp.Seek(0, 2)
+	st, err := fp.Stat()
 	if err != nil {
 		fp.Close()
 		return nil, err
 	}
-	if _, err := fp.Seek(0, 0); err != nil {
-		fp.Close()
+	if !st.Mode().IsRegular() {
+		return newStream(file, fp, fp)
+	}
+
+	data, err := readFile(fp)
+	fp.Close()
+	if err != nil {
 		return nil, err
 	}
 
+	if isSparse(data) {
+		return newSparse(file, data)
+	}
+
 	return &Bitstream{
 		file: file,
-		fp:   fp,
-		size: size,
-		buf:  make([]byte, device.FlashPageSize),
+		data: data,
+	}, nil
+}
+
+func newSparse(file string, data []byte) (*Bitstream, error) {
+	sparse, err := parseSparse(data)
+	if err != nil {
+		return nil, err
+	}
+	return &Bitstream{
+		file:   file,
+		sparse: sparse,
+	}, nil
+}
+
+// readFile reads the whole file, decompressing it if gzip compressed. Only
+// the decompressed data is kept in memory.
+func readFile(fp *os.File) ([]byte, error) {
+	rd := bufio.NewReader(fp)
+	if magic, _ := rd.Peek(len(gzipMagic)); bytes.Equal(magic, gzipMagic) {
+		gz, err := gzip.NewReader(rd)
+		if err != nil {
+			return nil, err
+		}
+		defer gz.Close()
+		return io.ReadAll(gz)
+	}
+	return io.ReadAll(rd)
+}
+
+func newStream(file string, rd io.Reader, fp *os.File) (*Bitstream, error) {
+	stream := bufio.NewReaderSize(rd, device.FlashBlockSize)
+	if magic, _ := stream.Peek(len(gzipMagic)); bytes.Equal(magic, gzipMagic) {
+		gz, err := gzip.NewReader(stream)
+		if err != nil {
+			if fp != nil {
+				fp.Close()
+			}
+			return nil, err
+		}
+		stream = bufio.NewReaderSize(gz, device.FlashBlockSize)
+	}
+
+	// sparse dumps can't be written as they are read, the extents are
+	// parsed first. they may be compressed too.
+	if magic, _ := stream.Peek(len(sparseMagic)); isSparse(magic) {
+		data, err := io.ReadAll(stream)
+		if fp != nil {
+			fp.Close()
+		}
+		if err != nil {
+			return nil, err
+		}
+		return newSparse(file, data)
+	}
+
+	return &Bitstream{
+		file:   file,
+		fp:     fp,
+		stream: stream,
+		hash:   crc32.NewIEEE(),
 	}, nil
 }
 
+func (bs *Bitstream) IsStream() bool {
+	return bs.stream != nil
+}
+
+func (bs *Bitstream) IsSparse() bool {
+	return bs.sparse != nil
+}
+
+// Extents returns the non-blank extents of a sparse flash dump, in address
+// order.
+func (bs *Bitstream) Extents() []Extent {
+	if bs.sparse == nil {
+		return nil
+	}
+	return bs.sparse.extents
+}
+
+// Size returns the size of the bitstream. For streaming inputs, this is the
+// amount of data consumed so far, and for sparse dumps, the size of the
+// flash memory they were read from.
 func (bs *Bitstream) Size() uint32 {
-	return uint32(bs.size)
+	if bs.stream != nil {
+		return bs.read
+	}
+	if bs.sparse != nil {
+		return bs.sparse.size
+	}
+	return uint32(len(bs.data))
 }
 
-func (bs *Bitstream) resetFp() error {
-	if bs.fp == nil {
+// Sum returns the CRC-32 (IEEE) of the bitstream, as calculated by the
+// device. For streaming inputs, this covers the data consumed so far.
+func (bs *Bitstream) Sum() uint32 {
+	if bs.hash != nil {
+		return bs.hash.Sum32()
+	}
+	if bs.sparse != nil {
+		h := crc32.NewIEEE()
+		bs.sparse.forEachPage(func(addr uint32, data []byte) error {
+			h.Write(data)
+			return nil
+		})
+		return h.Sum32()
+	}
+	return crc32.ChecksumIEEE(bs.data)
+}
+
+// Bytes returns the whole bitstream content. It is not available for
+// streaming inputs and sparse dumps.
+func (bs *Bitstream) Bytes() []byte {
+	return bs.data
+}
+
+func (bs *Bitstream) FlashPage(addr uint32) []byte {
+	if addr >= uint32(len(bs.data)) {
 		return nil
 	}
+	return bs.data[addr:min(addr+device.FlashPageSize, uint32(len(bs.data)))]
+}
 
-	_, err := bs.fp.Seek(0, 0)
-	return err
+func (bs *Bitstream) ReadAt(p []byte, off int64) (int, error) {
+	if bs.sparse != nil {
+		return bs.sparse.ReadAt(p, off)
+	}
+	if off < 0 || off >= int64(len(bs.data)) {
+		return 0, io.EOF
+	}
+
+	n := copy(p, bs.data[off:])
+	if n < len(p) {
+		return n, io.EOF
+	}
+	return n, nil
 }
 
 func (bs *Bitstream) ForEachFlashPage(f func(addr uint32, data []byte) error) error {
@@ -56,56 +212,98 @@ func (bs *Bitstream) ForEachFlashPage(f func(addr uint32, data []byte) error) er
 		return nil
 	}
 
-	if err := bs.resetFp(); err != nil {
-		return err
+	if bs.stream != nil {
+		return bs.forEachStreamPage(f)
+	}
+	if bs.sparse != nil {
+		return bs.sparse.forEachPage(f)
 	}
 
-	addr := 0
-	for {
-		r, err := bs.fp.Read(bs.buf)
-		if err != nil {
-			if err == io.EOF {
-				return nil
-			}
-			return err
-		}
-
-		if err := f(uint32(addr), bs.buf[:r]); err != nil {
+	for addr := uint32(0); addr < uint32(len(bs.data)); addr += device.FlashPageSize {
+		if err := f(addr, bs.FlashPage(addr)); err != nil {
 			return err
 		}
-		addr += r
 	}
+	return nil
 }
 
-func (bs *Bitstream) listFlash(sz uint32) []uint32 {
-	rv := []uint32{}
-	if bs.size == 0 {
-		return rv
-	}
+type streamPage struct {
+	data []byte
+	err  error
+}
+
+// readStream reads (and decompresses) the stream in the background, so that
+// it overlaps with the pages being written. Only streamQueuePages buffers
+// exist, and they are reused as they are returned to free.
+func (bs *Bitstream) readStream(pages chan<- streamPage, free chan []byte, stop <-chan struct{}) {
+	defer close(pages)
 
-	addr := uint32(0)
 	for {
-		rv = append(rv, addr)
-		addr += sz
-		if addr > uint32(bs.size) {
-			return rv
+		var buf []byte
+		select {
+		case buf = <-free:
+		case <-stop:
+			return
+		}
+
+		p := streamPage{}
+		r, err := io.ReadFull(bs.stream, buf)
+		switch err {
+		case nil, io.ErrUnexpectedEOF:
+			p.data = buf[:r]
+		case io.EOF:
+			return
+		default:
+			p.err = err
+		}
+
+		select {
+		case pages <- p:
+		case <-stop:
+			return
+		}
+
+		if p.err != nil || r < len(buf) {
+			return
 		}
 	}
 }
 
-func (bs *Bitstream) ListFlashPages() []uint32 {
-	return bs.listFlash(device.FlashPageSize)
-}
+func (bs *Bitstream) forEachStreamPage(f func(addr uint32, data []byte) error) error {
+	if bs.consumed {
+		return ErrStreamConsumed
+	}
+	bs.consumed = true
 
-func (bs *Bitstream) ListFlashSectors() []uint32 {
-	return bs.listFlash(device.FlashSectorSize)
-}
+	free := make(chan []byte, streamQueuePages)
+	for range streamQueuePages {
+		free <- make([]byte, device.FlashPageSize)
+	}
+	pages := make(chan streamPage, streamQueuePages)
+	stop := make(chan struct{})
+	defer close(stop)
+
+	go bs.readStream(pages, free, stop)
 
-func (bs *Bitstream) ListFlashBlocks() []uint32 {
-	return bs.listFlash(device.FlashBlockSize)
+	for p := range pages {
+		if p.err != nil {
+			return p.err
+		}
+
+		bs.hash.Write(p.data)
+		if err := f(bs.read, p.data); err != nil {
+			return err
+		}
+		bs.read += uint32(len(p.data))
+
+		free <- p.data[:cap(p.data)]
+	}
+	return nil
 }
 
 func (bs *Bitstream) Close() error {
+	bs.data = nil
+	bs.sparse = nil
 	if bs.fp == nil {
 		return nil
 	}
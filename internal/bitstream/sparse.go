@@ -0,0 +1,206 @@
+package bitstream
+
+import (
+	"bytes"
+	"encoding/binary"
+	"errors"
+	"fmt"
+	"io"
+	"sort"
+
+	"rafaelmartins.com/p/iceflashprog/internal/device"
+)
+
+// A sparse dump holds only the non-blank extents of a flash memory, the
+// rest is erased (0xff):
+//
+//	magic (8) | version (1) | reserved (3) | flash size (4)
+//	address (4) | length (4) | data (length)
+//	...
+//
+// Integers are big endian, extents are in address order and don't overlap.
+const (
+	sparseMagic      = "ICEFPSPR"
+	sparseVersion    = 1
+	sparseHeaderSize = len(sparseMagic) + 4 + 4
+	sparseExtentSize = 8
+
+	// sparseMaxSize is the largest flash memory detected from the JEDEC ID.
+	sparseMaxSize = 1 << 28
+)
+
+var ErrInvalidSparse = errors.New("iceflashprog: bitstream: invalid sparse dump")
+
+func isSparse(data []byte) bool {
+	return bytes.HasPrefix(data, []byte(sparseMagic))
+}
+
+// Extent is a non-blank range of a sparse flash dump.
+type Extent struct {
+	Address uint32
+	Data    []byte
+}
+
+type sparseDump struct {
+	size    uint32
+	extents []Extent
+}
+
+// parseSparse returns the extents of a sparse dump, without copying them
+// and without expanding the blank space between them.
+func parseSparse(data []byte) (*sparseDump, error) {
+	if len(data) < sparseHeaderSize || !isSparse(data) {
+		return nil, fmt.Errorf("%w: bad header", ErrInvalidSparse)
+	}
+	if data[len(sparseMagic)] != sparseVersion {
+		return nil, fmt.Errorf("%w: unsupported version: %d", ErrInvalidSparse, data[len(sparseMagic)])
+	}
+
+	rv := &sparseDump{
+		size: binary.BigEndian.Uint32(data[len(sparseMagic)+4:]),
+	}
+	if rv.size > sparseMaxSize {
+		return nil, fmt.Errorf("%w: size too large: %d", ErrInvalidSparse, rv.size)
+	}
+
+	end := uint32(0)
+	for rest := data[sparseHeaderSize:]; len(rest) > 0; {
+		if len(rest) < sparseExtentSize {
+			return nil, fmt.Errorf("%w: truncated extent", ErrInvalidSparse)
+		}
+
+		addr := binary.BigEndian.Uint32(rest)
+		length := binary.BigEndian.Uint32(rest[4:])
+		rest = rest[sparseExtentSize:]
+
+		if addr < end || uint64(addr)+uint64(length) > uint64(rv.size) || uint64(length) > uint64(len(rest)) {
+			return nil, fmt.Errorf("%w: bad extent at %#x", ErrInvalidSparse, addr)
+		}
+
+		if length > 0 {
+			rv.extents = append(rv.extents, Extent{Address: addr, Data: rest[:length]})
+		}
+		rest = rest[length:]
+		end = addr + length
+	}
+	return rv, nil
+}
+
+func (d *sparseDump) ReadAt(p []byte, off int64) (int, error) {
+	if off < 0 || off >= int64(d.size) {
+		return 0, io.EOF
+	}
+
+	n := int(min(int64(len(p)), int64(d.size)-off))
+	for i := range p[:n] {
+		p[i] = 0xff
+	}
+
+	i := sort.Search(len(d.extents), func(i int) bool {
+		e := d.extents[i]
+		return int64(e.Address)+int64(len(e.Data)) > off
+	})
+	for _, e := range d.extents[i:] {
+		if int64(e.Address) >= off+int64(n) {
+			break
+		}
+		if int64(e.Address) >= off {
+			copy(p[int64(e.Address)-off:n], e.Data)
+		} else {
+			copy(p[:n], e.Data[off-int64(e.Address):])
+		}
+	}
+
+	if n < len(p) {
+		return n, io.EOF
+	}
+	return n, nil
+}
+
+// forEachPage calls f for each flash page of the whole dump, the blank ones
+// included. The page buffer is reused between calls.
+func (d *sparseDump) forEachPage(f func(addr uint32, data []byte) error) error {
+	buf := make([]byte, device.FlashPageSize)
+	for addr := uint32(0); addr < d.size; addr += device.FlashPageSize {
+		n, _ := d.ReadAt(buf, int64(addr))
+		if err := f(addr, buf[:n]); err != nil {
+			return err
+		}
+	}
+	return nil
+}
+
+// SparseWriter writes a sparse flash dump. Contiguous writes are merged into
+// a single extent.
+type SparseWriter struct {
+	w      *Writer
+	size   uint32
+	addr   uint32
+	extent []byte
+}
+
+func CreateSparse(file string, size uint32) (*SparseWriter, error) {
+	w, err := Create(file)
+	if err != nil {
+		return nil, err
+	}
+
+	hdr := make([]byte, sparseHeaderSize)
+	copy(hdr, sparseMagic)
+	hdr[len(sparseMagic)] = sparseVersion
+	binary.BigEndian.PutUint32(hdr[len(sparseMagic)+4:], size)
+	if _, err := w.Write(hdr); err != nil {
+		w.Close()
+		return nil, err
+	}
+
+	return &SparseWriter{
+		w:    w,
+		size: size,
+	}, nil
+}
+
+func (w *SparseWriter) flush() error {
+	if len(w.extent) == 0 {
+		return nil
+	}
+
+	hdr := make([]byte, sparseExtentSize)
+	binary.BigEndian.PutUint32(hdr, w.addr)
+	binary.BigEndian.PutUint32(hdr[4:], uint32(len(w.extent)))
+	if _, err := w.w.Write(hdr); err != nil {
+		return err
+	}
+	if _, err := w.w.Write(w.extent); err != nil {
+		return err
+	}
+
+	w.extent = w.extent[:0]
+	return nil
+}
+
+// WriteAt adds data at the given flash address. Writes must be in address
+// order, the gaps between them are erased.
+func (w *SparseWriter) WriteAt(p []byte, off int64) (int, error) {
+	end := w.addr + uint32(len(w.extent))
+	if off < int64(end) || off+int64(len(p)) > int64(w.size) {
+		return 0, fmt.Errorf("%w: write out of order at %#x", ErrInvalidSparse, off)
+	}
+
+	if off != int64(end) {
+		if err := w.flush(); err != nil {
+			return 0, err
+		}
+		w.addr = uint32(off)
+	}
+	w.extent = append(w.extent, p...)
+	return len(p), nil
+}
+
+func (w *SparseWriter) Close() error {
+	if err := w.flush(); err != nil {
+		w.w.Close()
+		return err
+	}
+	return w.w.Close()
+}
@@ -0,0 +1,169 @@
+package bitstream
+
+import (
+	"bytes"
+	"compress/gzip"
+	"encoding/binary"
+	"errors"
+	"os"
+	"path/filepath"
+	"testing"
+
+	"rafaelmartins.com/p/iceflashprog/internal/device"
+)
+
+const testSparseSize = 4 * device.FlashSectorSize
+
+func page(b byte) []byte {
+	return bytes.Repeat([]byte{b}, device.FlashPageSize)
+}
+
+func writeTestSparse(t *testing.T, file string) []byte {
+	w, err := CreateSparse(file, testSparseSize)
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	// two contiguous pages, merged into one extent, and a single page.
+	for _, addr := range []uint32{0, device.FlashPageSize, 2 * device.FlashSectorSize} {
+		if _, err := w.WriteAt(page(byte(addr>>8)), int64(addr)); err != nil {
+			t.Fatal(err)
+		}
+	}
+	if err := w.Close(); err != nil {
+		t.Fatal(err)
+	}
+
+	rv := bytes.Repeat([]byte{0xff}, testSparseSize)
+	copy(rv, page(0))
+	copy(rv[device.FlashPageSize:], page(1))
+	copy(rv[2*device.FlashSectorSize:], page(0x20))
+	return rv
+}
+
+func checkTestSparse(t *testing.T, bs *Bitstream, expected []byte) {
+	if !bs.IsSparse() || bs.IsStream() {
+		t.Fatalf("not a sparse dump")
+	}
+	if bs.Size() != testSparseSize {
+		t.Fatalf("invalid size: %d", bs.Size())
+	}
+
+	ext := bs.Extents()
+	if len(ext) != 2 {
+		t.Fatalf("invalid extents: %d", len(ext))
+	}
+	if ext[0].Address != 0 || !bytes.Equal(ext[0].Data, expected[:2*device.FlashPageSize]) {
+		t.Fatalf("invalid extent 0: %#x, %d bytes", ext[0].Address, len(ext[0].Data))
+	}
+	if ext[1].Address != 2*device.FlashSectorSize || !bytes.Equal(ext[1].Data, page(0x20)) {
+		t.Fatalf("invalid extent 1: %#x, %d bytes", ext[1].Address, len(ext[1].Data))
+	}
+
+	data := []byte{}
+	if err := bs.ForEachFlashPage(func(addr uint32, p []byte) error {
+		if addr != uint32(len(data)) {
+			t.Fatalf("invalid page address: %#x", addr)
+		}
+		data = append(data, p...)
+		return nil
+	}); err != nil {
+		t.Fatal(err)
+	}
+	if !bytes.Equal(data, expected) {
+		t.Fatal("invalid expanded content")
+	}
+
+	// reads crossing extent edges.
+	buf := make([]byte, 3*device.FlashPageSize)
+	off := int64(2*device.FlashSectorSize - device.FlashPageSize - 1)
+	if n, err := bs.ReadAt(buf, off); err != nil || n != len(buf) || !bytes.Equal(buf, expected[off:off+int64(n)]) {
+		t.Fatalf("invalid read at %#x: %d, %v", off, n, err)
+	}
+	if n, _ := bs.ReadAt(buf, testSparseSize-10); n != 10 {
+		t.Fatalf("invalid short read: %d", n)
+	}
+}
+
+func TestSparseRoundTrip(t *testing.T) {
+	file := filepath.Join(t.TempDir(), "dump.bin")
+	expected := writeTestSparse(t, file)
+
+	bs, err := New(file)
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer bs.Close()
+
+	checkTestSparse(t, bs, expected)
+}
+
+func TestSparseCompressed(t *testing.T) {
+	dir := t.TempDir()
+	expected := writeTestSparse(t, filepath.Join(dir, "dump.bin"))
+
+	data, err := os.ReadFile(filepath.Join(dir, "dump.bin"))
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	buf := &bytes.Buffer{}
+	gz := gzip.NewWriter(buf)
+	gz.Write(data)
+	if err := gz.Close(); err != nil {
+		t.Fatal(err)
+	}
+
+	file := filepath.Join(dir, "dump.bin.gz")
+	if err := os.WriteFile(file, buf.Bytes(), 0666); err != nil {
+		t.Fatal(err)
+	}
+
+	bs, err := New(file)
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer bs.Close()
+
+	checkTestSparse(t, bs, expected)
+}
+
+func sparseHeader(version byte, size uint32) []byte {
+	rv := make([]byte, sparseHeaderSize)
+	copy(rv, sparseMagic)
+	rv[len(sparseMagic)] = version
+	binary.BigEndian.PutUint32(rv[len(sparseMagic)+4:], size)
+	return rv
+}
+
+func extent(addr uint32, length uint32, data int) []byte {
+	rv := make([]byte, sparseExtentSize+data)
+	binary.BigEndian.PutUint32(rv, addr)
+	binary.BigEndian.PutUint32(rv[4:], length)
+	return rv
+}
+
+func TestSparseInvalid(t *testing.T) {
+	hdr := sparseHeader(sparseVersion, testSparseSize)
+
+	for name, data := range map[string][]byte{
+		"short header":     hdr[:sparseHeaderSize-1],
+		"bad version":      sparseHeader(sparseVersion+1, testSparseSize),
+		"size too large":   sparseHeader(sparseVersion, sparseMaxSize+1),
+		"truncated extent": append(hdr, 0, 0, 0),
+		"truncated data":   append(hdr, extent(0, 10, 9)...),
+		"out of bounds":    append(hdr, extent(testSparseSize-5, 10, 10)...),
+		"overflow":         append(hdr, extent(0xffffffff, 2, 2)...),
+		"out of order":     append(append(hdr, extent(0x200, 1, 1)...), extent(0x100, 1, 1)...),
+		"overlap":          append(append(hdr, extent(0x100, 2, 2)...), extent(0x101, 1, 1)...),
+	} {
+		if _, err := parseSparse(data); !errors.Is(err, ErrInvalidSparse) {
+			t.Errorf("%s: expected invalid sparse error, got %v", name, err)
+		}
+	}
+
+	// the header size is not allocated.
+	if d, err := parseSparse(sparseHeader(sparseVersion, sparseMaxSize)); err != nil || d.size != sparseMaxSize || len(d.extents) != 0 {
+		t.Fatalf("invalid empty dump: %v", err)
+	}
+}
@@ -0,0 +1,106 @@
+package bitstream
+
+import (
+	"errors"
+	"os"
+	"path/filepath"
+)
+
+const (
+	writerChunkSize  = 0x10000
+	writerChunkCount = 4
+)
+
+var errWriterClosed = errors.New("iceflashprog: bitstream: writer is closed")
+
+// Writer buffers flash data in memory and writes it to disk from a separate
+// goroutine, so that file I/O does not stall the USB transfers feeding it.
+type Writer struct {
+	fp   *os.File
+	buf  []byte
+	free chan []byte
+	full chan []byte
+	done chan error
+	err  error
+}
+
+func Create(file string) (*Writer, error) {
+	if err := os.MkdirAll(filepath.Dir(file), 0777); err != nil {
+		return nil, err
+	}
+
+	fp, err := os.Create(file)
+	if err != nil {
+		return nil, err
+	}
+
+	w := &Writer{
+		fp:   fp,
+		free: make(chan []byte, writerChunkCount),
+		full: make(chan []byte, writerChunkCount),
+		done: make(chan error, 1),
+	}
+	for range writerChunkCount - 1 {
+		w.free <- make([]byte, 0, writerChunkSize)
+	}
+	w.buf = make([]byte, 0, writerChunkSize)
+
+	go w.loop()
+	return w, nil
+}
+
+func (w *Writer) loop() {
+	var err error
+	for chunk := range w.full {
+		if err == nil {
+			_, err = w.fp.Write(chunk)
+		}
+		w.free <- chunk[:0]
+	}
+	w.done <- err
+}
+
+func (w *Writer) Write(p []byte) (int, error) {
+	if w.err != nil {
+		return 0, w.err
+	}
+
+	n := len(p)
+	for len(p) > 0 {
+		c := copy(w.buf[len(w.buf):cap(w.buf)], p)
+		w.buf = w.buf[:len(w.buf)+c]
+		p = p[c:]
+
+		if len(w.buf) == cap(w.buf) {
+			w.full <- w.buf
+			w.buf = <-w.free
+		}
+	}
+	return n, nil
+}
+
+func (w *Writer) Close() error {
+	if w.err != nil {
+		if w.err == errWriterClosed {
+			return nil
+		}
+		return w.err
+	}
+
+	if len(w.buf) > 0 {
+		w.full <- w.buf
+	}
+	w.buf = nil
+	close(w.full)
+
+	err := <-w.done
+	if err2 := w.fp.Close(); err == nil {
+		err = err2
+	}
+
+	w.err = errWriterClosed
+	if err != nil {
+		w.err = err
+	}
+	return err
+}
@@ -0,0 +1,211 @@
+package device
+
+import (
+	"errors"
+	"fmt"
+	"time"
+)
+
+type Feature uint32
+
+const (
+	FeatureJobs Feature = 1 << iota
+	FeatureCRC
+	FeatureEvents
+	FeatureSRAM
+	FeatureAddress4B
+	FeatureProgramNoVerify
+)
+
+type BuildOption uint32
+
+const (
+	BuildOptionSPIMaxFreq BuildOption = 1 << iota
+	BuildOptionWatchdogStopOnHalt
+	BuildOptionSchedStats
+)
+
+type capability = byte
+
+const (
+	capabilityVersion capability = iota
+	capabilityFeatures
+	capabilityBuffers
+	capabilitySPIClock
+	capabilityBuildOptions
+	capabilityCount
+
+	// only with BuildOptionSchedStats, not part of the capabilities.
+	capabilityMaxUSBLatency = capabilityCount
+	capabilityMaxTaskRun    = capabilityCount + 1
+)
+
+var ErrUnsupported = errors.New("iceflashprog: protocol: operation not supported by the device firmware")
+
+// Capabilities describes what the device firmware supports, so that the
+// fastest path available can be used.
+type Capabilities struct {
+	// Version is the protocol version, 0 for firmware without capabilities.
+	Version      byte
+	Features     Feature
+	BuildOptions BuildOption
+	JobMaxSteps  int
+	PageBuffers  int
+	PageSize     int
+
+	// SPIClock is the flash memory clock, in Hz. 0 if unknown.
+	SPIClock uint32
+}
+
+var (
+	// legacyCapabilities describes the original firmware, with 3-byte
+	// addresses, erases that respond only once done and no jobs.
+	legacyCapabilities = Capabilities{
+		PageBuffers: 1,
+		PageSize:    FlashPageSize,
+	}
+
+	// currentCapabilities describes firmware that uses the current reports,
+	// but predates capabilities. It is also assumed before negotiation.
+	currentCapabilities = Capabilities{
+		Features:    FeatureJobs | FeatureCRC | FeatureEvents | FeatureSRAM | FeatureAddress4B | FeatureProgramNoVerify,
+		JobMaxSteps: JobMaxSteps,
+		PageBuffers: 1,
+		PageSize:    FlashPageSize,
+	}
+)
+
+func (c *Capabilities) Has(f Feature) bool {
+	return c.Features&f == f
+}
+
+// getCapability requests a capability value using the short command report
+// of the original firmware, that replies with an error instead of ignoring
+// it. Firmware with capabilities replies even if not powered up.
+func (d *Device) getCapability(c capability) (uint32, error) {
+	data, err := d.roundTrip(reportData, reportData, []byte{dataCapabilities, c, 0, 0})
+	if err != nil {
+		return 0, err
+	}
+	return uint32(data[0])<<16 | uint32(data[1])<<8 | uint32(data[2]), nil
+}
+
+// probeLegacy tells the original firmware apart from later firmware without
+// capabilities, given the error they responded to the capabilities probe
+// with. The original firmware doesn't know the command, and the later one
+// rejects the short report. Both mask every status while unpowered, so in
+// that case the device is powered up with the short report, that only the
+// original firmware accepts.
+func (d *Device) probeLegacy(err error) (bool, error) {
+	switch {
+	case errors.Is(err, ErrInvalidCommandId):
+		return true, nil
+
+	case errors.Is(err, ErrInvalidRequest):
+		return false, nil
+
+	case errors.Is(err, ErrUnpowered):
+		d.codec.legacy = true
+		_, err := d.roundTrip(reportData, reportData, d.codec.encodeCommand(dataPowerUp, 0))
+		d.codec.legacy = false
+		if err == nil {
+			return true, nil
+		}
+		if errors.Is(err, ErrUnpowered) {
+			return false, nil
+		}
+	}
+	return false, err
+}
+
+// GetCapabilities negotiates the protocol with the device, and must be
+// called before powering up. Firmware without capabilities may be powered
+// up by it. The result is cached.
+func (d *Device) GetCapabilities() (*Capabilities, error) {
+	d.m.Lock()
+	defer d.m.Unlock()
+
+	if d.caps != nil {
+		return d.caps, nil
+	}
+
+	values := [capabilityCount]uint32{}
+	for i := range values {
+		v, err := d.getCapability(capability(i))
+		if err != nil {
+			if i != 0 {
+				return nil, err
+			}
+
+			legacy, err := d.probeLegacy(err)
+			if err != nil {
+				return nil, err
+			}
+			if legacy {
+				d.setCapabilities(&legacyCapabilities)
+			} else {
+				d.setCapabilities(&currentCapabilities)
+			}
+			return d.caps, nil
+		}
+		values[i] = v
+	}
+
+	c := &Capabilities{
+		Version:      byte(values[capabilityVersion] >> 16),
+		Features:     Feature(values[capabilityFeatures]),
+		BuildOptions: BuildOption(values[capabilityBuildOptions]),
+		JobMaxSteps:  int(byte(values[capabilityVersion] >> 8)),
+		PageBuffers:  int(byte(values[capabilityBuffers] >> 16)),
+		PageSize:     int(uint16(values[capabilityBuffers])),
+		SPIClock:     values[capabilitySPIClock] * 1000,
+	}
+	if c.Has(FeatureJobs) && int(byte(values[capabilityVersion])) != jobReportSteps {
+		return nil, fmt.Errorf("iceflashprog: protocol: unsupported job report steps: %d", byte(values[capabilityVersion]))
+	}
+	if c.PageSize != FlashPageSize {
+		return nil, fmt.Errorf("iceflashprog: protocol: unsupported page size: %d", c.PageSize)
+	}
+
+	d.setCapabilities(c)
+	return d.caps, nil
+}
+
+func (d *Device) setCapabilities(c *Capabilities) {
+	d.caps = c
+	d.codec.legacy = !c.Has(FeatureAddress4B)
+}
+
+// Capabilities returns the capabilities negotiated by GetCapabilities, or the
+// ones of the current firmware if not negotiated.
+func (d *Device) Capabilities() *Capabilities {
+	d.m.Lock()
+	defer d.m.Unlock()
+
+	if d.caps == nil {
+		return &currentCapabilities
+	}
+	return d.caps
+}
+
+// GetSchedulerStats returns the worst-case USB service latency and the
+// longest main loop task step measured by the firmware, if built with
+// scheduler stats.
+func (d *Device) GetSchedulerStats() (time.Duration, time.Duration, error) {
+	if d.Capabilities().BuildOptions&BuildOptionSchedStats == 0 {
+		return 0, 0, ErrUnsupported
+	}
+
+	d.m.Lock()
+	defer d.m.Unlock()
+
+	latency, err := d.getCapability(capabilityMaxUSBLatency)
+	if err != nil {
+		return 0, 0, err
+	}
+	run, err := d.getCapability(capabilityMaxTaskRun)
+	if err != nil {
+		return 0, 0, err
+	}
+	return time.Duration(latency) * time.Microsecond, time.Duration(run) * time.Microsecond, nil
+}
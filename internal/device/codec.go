@@ -0,0 +1,106 @@
+package device
+
+import (
+	"bytes"
+	"fmt"
+)
+
+// erasedPage is copied over the tail of short pages, flash memory reads
+// 0xff where nothing was programmed.
+var erasedPage = bytes.Repeat([]byte{0xff}, FlashPageSize)
+
+// codec encodes requests into report buffers that are reused for the
+// lifetime of the device, so that the per-page path does not allocate. It
+// must only be used with the device call lock held.
+type codec struct {
+	command [5]byte
+	page    [4 + FlashPageSize]byte
+	job     [1 + jobReportSteps*jobStepSize]byte
+
+	// legacy selects the 3-byte addresses of the original firmware, for
+	// commands and pages.
+	legacy bool
+}
+
+// putAddress encodes addresses and lengths as 32-bit big endian values.
+func putAddress(b []byte, addr uint32) {
+	b[0] = byte(addr >> 24)
+	b[1] = byte(addr >> 16)
+	b[2] = byte(addr >> 8)
+	b[3] = byte(addr)
+}
+
+// addressOffset returns where the address starts in the 4-byte field, the
+// most significant byte is dropped for legacy reports.
+func (c *codec) addressOffset() int {
+	if c.legacy {
+		return 1
+	}
+	return 0
+}
+
+func (c *codec) encodeCommand(cmd data, addr uint32) []byte {
+	o := c.addressOffset()
+	putAddress(c.command[1:], addr)
+	c.command[o] = cmd
+	return c.command[o:]
+}
+
+func (c *codec) encodePage(addr uint32, data []byte) ([]byte, error) {
+	if l := len(data); l > FlashPageSize {
+		return nil, fmt.Errorf("iceflashprog: protocol: got more data to write to flash than one page: %d", l)
+	}
+
+	putAddress(c.page[:], addr)
+	n := copy(c.page[4:], data)
+	copy(c.page[4+n:], erasedPage)
+	return c.page[c.addressOffset():], nil
+}
+
+func (c *codec) encodeJob(steps []JobStep) ([]byte, error) {
+	if l := len(steps); l > jobReportSteps {
+		return nil, fmt.Errorf("iceflashprog: protocol: too many steps for job report: %d", l)
+	}
+
+	clear(c.job[:])
+	c.job[0] = byte(len(steps))
+	for i, s := range steps {
+		if s.Length == 0 || uint64(s.Address)+uint64(s.Length) > 1<<32 {
+			return nil, fmt.Errorf("iceflashprog: protocol: invalid job step: %+v", s)
+		}
+
+		b := c.job[1+i*jobStepSize:]
+		b[0] = byte(s.Op)
+		putAddress(b[1:], s.Address)
+		putAddress(b[5:], s.Length)
+	}
+	return c.job[:], nil
+}
+
+// decodeResponse validates a response report, and returns its payload. The
+// payload is a slice of the input buffer, nothing is copied.
+func decodeResponse(expected report, id byte, data []byte) ([]byte, error) {
+	if id != expected {
+		return nil, fmt.Errorf("iceflashprog: protocol: invalid report id for response: %d", expected)
+	}
+
+	switch expected {
+	case reportFlashPage:
+		if l := len(data); l != FlashPageSize {
+			return nil, fmt.Errorf("iceflashprog: protocol: invalid response data length for report %d: %d", expected, l)
+		}
+		return data, nil
+
+	case reportData:
+		if l := len(data); l != 4 {
+			return nil, fmt.Errorf("iceflashprog: protocol: invalid response data length for report %d: %d", expected, l)
+		}
+
+		if err := statusError(data[0]); err != nil {
+			return nil, err
+		}
+		return data[1:], nil
+	}
+
+	return nil, fmt.Errorf("iceflashprog: protocol: unknown error")
+}
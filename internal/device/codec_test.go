@@ -0,0 +1,142 @@
+package device
+
+import (
+	"bytes"
+	"testing"
+)
+
+func getAddress(b []byte) uint32 {
+	return uint32(b[0])<<24 | uint32(b[1])<<16 | uint32(b[2])<<8 | uint32(b[3])
+}
+
+func TestCodecRoundTrip(t *testing.T) {
+	for _, legacy := range []bool{false, true} {
+		c := &codec{legacy: legacy}
+		o := c.addressOffset()
+
+		cmd := c.encodeCommand(dataRead, 0x123456)
+		if len(cmd) != 5-o || cmd[0] != dataRead {
+			t.Fatalf("legacy=%t: invalid command: %x", legacy, cmd)
+		}
+		if addr := getAddress(append(make([]byte, o), cmd[1:]...)); addr != 0x123456 {
+			t.Fatalf("legacy=%t: invalid command address: %#x", legacy, addr)
+		}
+
+		data := []byte{1, 2, 3}
+		page, err := c.encodePage(0x1000, data)
+		if err != nil {
+			t.Fatal(err)
+		}
+		if len(page) != 4-o+FlashPageSize {
+			t.Fatalf("legacy=%t: invalid page length: %d", legacy, len(page))
+		}
+		if addr := getAddress(append(make([]byte, o), page[:4-o]...)); addr != 0x1000 {
+			t.Fatalf("legacy=%t: invalid page address: %#x", legacy, addr)
+		}
+		if p := page[4-o:]; !bytes.Equal(p[:3], data) || !bytes.Equal(p[3:], erasedPage[3:]) {
+			t.Fatalf("legacy=%t: invalid page data: %x", legacy, p[:8])
+		}
+	}
+
+	c := &codec{}
+	steps := []JobStep{
+		{Op: JobEraseBlock, Address: 0x10000, Length: 0x20000},
+		{Op: JobCRC, Address: 0x10000, Length: 0x1234},
+	}
+	job, err := c.encodeJob(steps)
+	if err != nil {
+		t.Fatal(err)
+	}
+	if len(job) != 1+jobReportSteps*jobStepSize || int(job[0]) != len(steps) {
+		t.Fatalf("invalid job report: %x", job[:1])
+	}
+	for i, s := range steps {
+		b := job[1+i*jobStepSize:]
+		if got := (JobStep{Op: JobOp(b[0]), Address: getAddress(b[1:]), Length: getAddress(b[5:])}); got != s {
+			t.Fatalf("invalid job step %d: %+v", i, got)
+		}
+	}
+
+	if _, err := c.encodeJob(make([]JobStep, jobReportSteps+1)); err == nil {
+		t.Fatal("expected error for too many steps")
+	}
+	if _, err := c.encodePage(0, make([]byte, FlashPageSize+1)); err == nil {
+		t.Fatal("expected error for oversized page")
+	}
+
+	resp, err := decodeResponse(reportData, reportData, []byte{statusOk, 0xef, 0x40, 0x15})
+	if err != nil || !bytes.Equal(resp, []byte{0xef, 0x40, 0x15}) {
+		t.Fatalf("invalid response: %x, %v", resp, err)
+	}
+	if _, err := decodeResponse(reportData, reportData, []byte{statusLocked, 0, 0, 0}); err != ErrLocked {
+		t.Fatalf("expected locked error, got %v", err)
+	}
+	if _, err := decodeResponse(reportData, reportFlashPage, make([]byte, FlashPageSize)); err == nil {
+		t.Fatal("expected error for wrong report id")
+	}
+}
+
+func TestCodecAllocs(t *testing.T) {
+	c := &codec{}
+	data := make([]byte, FlashPageSize)
+	steps := make([]JobStep, jobReportSteps)
+	for i := range steps {
+		steps[i] = JobStep{Op: JobProgram, Address: uint32(i) * FlashPageSize, Length: FlashPageSize}
+	}
+	resp := []byte{statusOk, 1, 2, 3}
+
+	for name, f := range map[string]func(){
+		"encodeCommand":  func() { c.encodeCommand(dataRead, 0x1000) },
+		"encodePage":     func() { c.encodePage(0x1000, data) },
+		"encodeJob":      func() { c.encodeJob(steps) },
+		"decodeResponse": func() { decodeResponse(reportData, reportData, resp) },
+	} {
+		if n := testing.AllocsPerRun(100, f); n != 0 {
+			t.Errorf("%s: %v allocations per call", name, n)
+		}
+	}
+}
+
+func BenchmarkEncodeCommand(b *testing.B) {
+	c := &codec{}
+	b.ReportAllocs()
+	for i := 0; i < b.N; i++ {
+		c.encodeCommand(dataRead, uint32(i))
+	}
+}
+
+func BenchmarkEncodePage(b *testing.B) {
+	c := &codec{}
+	data := make([]byte, FlashPageSize)
+	b.ReportAllocs()
+	b.SetBytes(FlashPageSize)
+	for i := 0; i < b.N; i++ {
+		if _, err := c.encodePage(uint32(i)*FlashPageSize, data); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
+
+func BenchmarkEncodeJob(b *testing.B) {
+	c := &codec{}
+	steps := make([]JobStep, jobReportSteps)
+	for i := range steps {
+		steps[i] = JobStep{Op: JobProgram, Address: uint32(i) * FlashPageSize, Length: FlashPageSize}
+	}
+	b.ReportAllocs()
+	for i := 0; i < b.N; i++ {
+		if _, err := c.encodeJob(steps); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
+
+func BenchmarkDecodeResponse(b *testing.B) {
+	resp := []byte{statusOk, 1, 2, 3}
+	b.ReportAllocs()
+	for i := 0; i < b.N; i++ {
+		if _, err := decodeResponse(reportData, reportData, resp); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
@@ -1,26 +1,40 @@
 package device
 
 import (
+	"errors"
 	"fmt"
 	"sync"
+	"sync/atomic"
 
 	"rafaelmartins.com/p/usbhid"
 )
 
+var ErrDisconnected = errors.New("iceflashprog: device disconnected")
+
 type result struct {
 	id   byte
 	data []byte
 }
 
 type Device struct {
-	dev    *usbhid.Device
-	listen chan bool
+	dev     *usbhid.Device
+	listen  chan bool
+	stopped chan struct{}
+
+	m       sync.Mutex
+	codec   codec
+	result  chan result
+	pending atomic.Bool
+
+	opm sync.Mutex
+	op  *Operation
 
-	m      sync.Mutex
-	result chan result
+	flashSize uint32
+	caps      *Capabilities
 }
 
-func New(serialNumber string) (*Device, error) {
+// List returns all the iceflashprog devices connected to the host.
+func List() ([]*Device, error) {
 	devices, err := usbhid.Enumerate(func(d *usbhid.Device) bool {
 		if d.VendorId() != 0x16c0 {
 			return false
@@ -37,6 +51,21 @@ func New(serialNumber string) (*Device, error) {
 		return nil, err
 	}
 
+	rv := []*Device{}
+	for _, dev := range devices {
+		rv = append(rv, &Device{
+			dev: dev,
+		})
+	}
+	return rv, nil
+}
+
+func New(serialNumber string) (*Device, error) {
+	devices, err := List()
+	if err != nil {
+		return nil, err
+	}
+
 	if len(devices) == 0 {
 		if serialNumber != "" {
 			return nil, fmt.Errorf("iceflashprog: %w [%q]", usbhid.ErrNoDeviceFound, serialNumber)
@@ -46,9 +75,7 @@ func New(serialNumber string) (*Device, error) {
 
 	if serialNumber == "" {
 		if len(devices) == 1 {
-			return &Device{
-				dev: devices[0],
-			}, nil
+			return devices[0], nil
 		}
 
 		sn := []string{}
@@ -60,25 +87,52 @@ func New(serialNumber string) (*Device, error) {
 
 	for _, dev := range devices {
 		if dev.SerialNumber() == serialNumber {
-			return &Device{
-				dev: devices[0],
-			}, nil
+			return dev, nil
 		}
 	}
 
 	return nil, fmt.Errorf("iceflashprog: %w [%q]", usbhid.ErrNoDeviceFound, serialNumber)
 }
 
+func (d *Device) SerialNumber() string {
+	return d.dev.SerialNumber()
+}
+
+// Path returns the system path of the device, that identifies it while it
+// is connected.
+func (d *Device) Path() string {
+	return d.dev.Path()
+}
+
 func (d *Device) Open() error {
 	if err := d.dev.Open(true); err != nil {
 		return err
 	}
 
 	d.listen = make(chan bool)
+	d.stopped = make(chan struct{})
+	d.result = make(chan result)
 	return nil
 }
 
+// stop fails any pending request or operation once the listener is gone,
+// as no response can arrive anymore.
+func (d *Device) stop() {
+	close(d.stopped)
+
+	d.opm.Lock()
+	o := d.op
+	d.op = nil
+	d.opm.Unlock()
+
+	if o != nil {
+		o.complete(0, ErrDisconnected)
+	}
+}
+
 func (d *Device) Listen() error {
+	defer d.stop()
+
 	for {
 		select {
 		case <-d.listen:
@@ -93,46 +147,55 @@ func (d *Device) Listen() error {
 		if err != nil {
 			return err
 		}
+		if id == reportEvent {
+			if err := d.handleEvent(buf); err != nil {
+				return err
+			}
+			continue
+		}
 		if id != 1 && id != 2 {
 			continue
 		}
 
-		if d.result == nil {
+		if !d.pending.Load() {
 			return fmt.Errorf("iceflashprog: got result without any request pending: %+v", buf)
 		}
 
-		d.result <- result{
+		select {
+		case d.result <- result{
 			id:   id,
 			data: buf,
+		}:
+		case <-d.listen:
+			return nil
 		}
 	}
 }
 
+// call sends a request and waits for its response. It must be called with
+// the call lock held.
 func (d *Device) call(id byte, data []byte) (byte, []byte, error) {
-	d.m.Lock()
-	defer d.m.Unlock()
-
-	d.result = make(chan result)
+	d.pending.Store(true)
+	defer d.pending.Store(false)
 
 	if err := d.dev.SetOutputReport(id, data); err != nil {
-		close(d.result)
-		d.result = nil
 		return 0, nil, err
 	}
 
-	r := <-d.result
-
-	close(d.result)
-	d.result = nil
-
-	return r.id, r.data, nil
+	select {
+	case r := <-d.result:
+		return r.id, r.data, nil
+	case <-d.stopped:
+		return 0, nil, ErrDisconnected
+	}
 }
 
 func (d *Device) Close() error {
-	if err := d.PowerDown(); err != nil {
-		return err
-	}
+	err := d.PowerDown()
 
 	close(d.listen)
-	return d.dev.Close()
+	if cerr := d.dev.Close(); err == nil || errors.Is(err, ErrDisconnected) {
+		err = cerr
+	}
+	return err
 }
@@ -0,0 +1,113 @@
+package device
+
+import (
+	"fmt"
+)
+
+type JobOp byte
+
+const (
+	JobEraseSector JobOp = iota + 1
+	JobEraseBlock
+	JobProgram
+	JobCRC
+	JobProgramNoVerify
+)
+
+const (
+	// JobMaxSteps is the number of steps a job can have.
+	JobMaxSteps = 16
+
+	// jobReportSteps is the number of steps that fit in a single job report.
+	jobReportSteps = 6
+	jobStepSize    = 9
+)
+
+// JobStep is one step of a job executed by the device without host round
+// trips. Pages for JobProgram steps are sent with WriteJobPage, in order.
+type JobStep struct {
+	Op      JobOp
+	Address uint32
+	Length  uint32
+}
+
+func (d *Device) uploadJob(steps []JobStep) error {
+	d.m.Lock()
+	defer d.m.Unlock()
+
+	// an empty report clears any steps left queued on the device.
+	for first := true; first || len(steps) > 0; first = false {
+		chunk := steps[:min(len(steps), jobReportSteps)]
+		if first {
+			chunk = nil
+		}
+		steps = steps[len(chunk):]
+
+		buf, err := d.codec.encodeJob(chunk)
+		if err != nil {
+			return err
+		}
+		if _, err := d.roundTrip(reportJob, reportData, buf); err != nil {
+			return err
+		}
+	}
+	return nil
+}
+
+// RunJob uploads the steps to the device and starts executing them. The
+// progress callback receives the amount of bytes processed by the job so far.
+func (d *Device) RunJob(steps []JobStep, progress func(done uint32)) (*Operation, error) {
+	caps := d.Capabilities()
+	if !caps.Has(FeatureJobs) {
+		return nil, ErrUnsupported
+	}
+	for _, s := range steps {
+		if (s.Op == JobCRC && !caps.Has(FeatureCRC)) || (s.Op == JobProgramNoVerify && !caps.Has(FeatureProgramNoVerify)) {
+			return nil, ErrUnsupported
+		}
+	}
+
+	if len(steps) == 0 {
+		return nil, fmt.Errorf("iceflashprog: protocol: empty job")
+	}
+	if len(steps) > min(JobMaxSteps, caps.JobMaxSteps) {
+		return nil, fmt.Errorf("iceflashprog: protocol: too many job steps: %d", len(steps))
+	}
+
+	if err := d.uploadJob(steps); err != nil {
+		return nil, err
+	}
+	return d.opCallAsync(opJobRun, 0, progress)
+}
+
+// CRC calculates the CRC-32 (IEEE) of a flash memory range on the device.
+func (d *Device) CRC(addr uint32, length uint32) (uint32, error) {
+	o, err := d.RunJob([]JobStep{{Op: JobCRC, Address: addr, Length: length}}, nil)
+	if err != nil {
+		return 0, err
+	}
+	if err := o.Wait(); err != nil {
+		return 0, err
+	}
+
+	res := o.Results()
+	if len(res) != 1 {
+		return 0, fmt.Errorf("iceflashprog: protocol: invalid number of job results: %d", len(res))
+	}
+	return res[0], nil
+}
+
+// WriteJobPage sends a page to a running job's JobProgram step. It does not
+// wait for a response: the device only accepts the next page after the
+// current one was handed to the flash, and failures are reported by the job
+// operation itself.
+func (d *Device) WriteJobPage(addr uint32, data []byte) error {
+	d.m.Lock()
+	defer d.m.Unlock()
+
+	buf, err := d.codec.encodePage(addr, data)
+	if err != nil {
+		return err
+	}
+	return d.dev.SetOutputReport(reportFlashPage, buf)
+}
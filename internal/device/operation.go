@@ -0,0 +1,123 @@
+package device
+
+import (
+	"sync"
+	"time"
+)
+
+// Operation is a handle to a long running flash operation (e.g. erase),
+// that completes asynchronously on the device.
+type Operation struct {
+	command  data
+	progress func(value uint32)
+	done     chan struct{}
+	elapsed  time.Duration
+	err      error
+
+	// job tracking, updated from the listener goroutine.
+	m       sync.Mutex
+	step    int
+	stepc   chan struct{}
+	results []uint32
+	started []time.Time
+	ended   time.Time
+}
+
+func newOperation(command data, progress func(value uint32)) *Operation {
+	return &Operation{
+		command:  command,
+		progress: progress,
+		done:     make(chan struct{}),
+		step:     -1,
+		stepc:    make(chan struct{}),
+	}
+}
+
+func (o *Operation) setStep(idx int) {
+	o.m.Lock()
+	defer o.m.Unlock()
+
+	o.step = idx
+	for len(o.started) <= idx {
+		o.started = append(o.started, time.Now())
+	}
+	close(o.stepc)
+	o.stepc = make(chan struct{})
+}
+
+func (o *Operation) addResult(value uint32) {
+	o.m.Lock()
+	defer o.m.Unlock()
+
+	o.results = append(o.results, value)
+}
+
+func (o *Operation) complete(elapsed time.Duration, err error) {
+	o.m.Lock()
+	o.ended = time.Now()
+	o.m.Unlock()
+
+	o.elapsed = elapsed
+	o.err = err
+	close(o.done)
+}
+
+func (o *Operation) Done() <-chan struct{} {
+	return o.done
+}
+
+func (o *Operation) Wait() error {
+	<-o.done
+	return o.err
+}
+
+func (o *Operation) Elapsed() time.Duration {
+	<-o.done
+	return o.elapsed
+}
+
+// WaitStep blocks until the job reaches the step with the given index, or
+// finishes.
+func (o *Operation) WaitStep(idx int) error {
+	for {
+		o.m.Lock()
+		step, c := o.step, o.stepc
+		o.m.Unlock()
+
+		if step >= idx {
+			return nil
+		}
+
+		select {
+		case <-c:
+		case <-o.done:
+			return o.err
+		}
+	}
+}
+
+// Results returns the values reported by the job steps that produce results
+// (e.g. CRC), in order.
+func (o *Operation) Results() []uint32 {
+	<-o.done
+	return o.results
+}
+
+// StepDurations returns how long each job step took, as seen by the host,
+// for the steps that were started.
+func (o *Operation) StepDurations() []time.Duration {
+	<-o.done
+
+	o.m.Lock()
+	defer o.m.Unlock()
+
+	rv := make([]time.Duration, len(o.started))
+	for i, start := range o.started {
+		end := o.ended
+		if i+1 < len(o.started) {
+			end = o.started[i+1]
+		}
+		rv[i] = end.Sub(start)
+	}
+	return rv
+}
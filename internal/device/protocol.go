@@ -3,14 +3,14 @@ package device
 import (
 	"errors"
 	"fmt"
-	"slices"
+	"time"
 )
 
 const (
-	FlashSize       = 0x200000 // FIXME
-	FlashPageSize   = 0x000100
-	FlashSectorSize = 0x001000
-	FlashBlockSize  = 0x010000
+	DefaultFlashSize = 0x200000
+	FlashPageSize    = 0x000100
+	FlashSectorSize  = 0x001000
+	FlashBlockSize   = 0x010000
 )
 
 type operation = byte
@@ -20,10 +20,14 @@ const (
 	opPowerDown
 	opJedecId
 	opRead
-	opWrite
 	opEraseSector
 	opEraseBlock
 	opEraseChip
+	opOperationStatus
+	opSRAMStart
+	opSRAMFinish
+	opJobRun
+	opCapabilities
 )
 
 type data = byte
@@ -36,6 +40,11 @@ const (
 	dataEraseSector
 	dataEraseBlock
 	dataEraseChip
+	dataOperationStatus
+	dataSRAMStart
+	dataSRAMFinish
+	dataJobRun
+	dataCapabilities
 )
 
 type report = byte
@@ -43,6 +52,17 @@ type report = byte
 const (
 	reportFlashPage report = iota + 1
 	reportData
+	reportEvent
+	reportJob
+)
+
+type event = byte
+
+const (
+	eventProgress event = iota + 1
+	eventComplete
+	eventStep
+	eventResult
 )
 
 type status = byte
@@ -55,6 +75,7 @@ const (
 	statusInvalidFlashPageRead
 	statusInvalidFlashPageWrite
 	statusLocked
+	statusJobFailed
 )
 
 var (
@@ -64,6 +85,7 @@ var (
 	ErrInvalidFlashPageRead  = errors.New("iceflashprog: protocol: invalid flash page read")
 	ErrInvalidFlashPageWrite = errors.New("iceflashprog: protocol: invalid flash page write, failed to verify")
 	ErrLocked                = errors.New("iceflashprog: protocol: device is locked")
+	ErrJobFailed             = errors.New("iceflashprog: protocol: job failed")
 
 	errorMap = map[status]error{
 		statusOk:                    nil,
@@ -73,6 +95,7 @@ var (
 		statusInvalidFlashPageRead:  ErrInvalidFlashPageRead,
 		statusInvalidFlashPageWrite: ErrInvalidFlashPageWrite,
 		statusLocked:                ErrLocked,
+		statusJobFailed:             ErrJobFailed,
 	}
 
 	operationMap = map[operation]struct {
@@ -84,122 +107,267 @@ var (
 		opPowerDown:   {dataPowerDown, 2, 2},
 		opJedecId:     {dataJedecId, 2, 2},
 		opRead:        {dataRead, 2, 1},
-		opWrite:       {0, 1, 2},
 		opEraseSector: {dataEraseSector, 2, 2},
 		opEraseBlock:  {dataEraseBlock, 2, 2},
 		opEraseChip:   {dataEraseChip, 2, 2},
+
+		opOperationStatus: {dataOperationStatus, 2, 2},
+		opSRAMStart:       {dataSRAMStart, 2, 2},
+		opSRAMFinish:      {dataSRAMFinish, 2, 2},
+		opJobRun:          {dataJobRun, 2, 2},
 	}
 )
 
-func (d *Device) opCall(op operation, data []byte) ([]byte, error) {
+func statusError(s status) error {
+	err, ok := errorMap[s]
+	if !ok {
+		return fmt.Errorf("iceflashprog: protocol: unknown error: %d", s)
+	}
+	return err
+}
+
+func elapsedProgress(progress func(elapsed time.Duration)) func(value uint32) {
+	if progress == nil {
+		return nil
+	}
+	return func(value uint32) {
+		progress(time.Duration(value) * time.Millisecond)
+	}
+}
+
+func (d *Device) opCallAsync(op operation, addr uint32, progress func(value uint32)) (*Operation, error) {
 	obj, ok := operationMap[op]
 	if !ok {
 		return nil, fmt.Errorf("iceflashprog: protocol: invalid operation: %d", op)
 	}
 
-	dataToSend := []byte{}
+	o := newOperation(obj.data, progress)
 
-	switch obj.requestId {
-	case reportFlashPage:
-		if l := len(data); l != 259 {
-			return nil, fmt.Errorf("iceflashprog: protocol: invalid request data length for report %d: %d", obj.requestId, l)
+	// firmware without events only responds once the operation is done.
+	if !d.Capabilities().Has(FeatureEvents) {
+		start := time.Now()
+		if _, err := d.opCall(op, addr); err != nil {
+			return nil, err
 		}
-		dataToSend = data
+		o.complete(time.Since(start), nil)
+		return o, nil
+	}
 
-	case reportData:
-		if l := len(data); l != 3 {
-			return nil, fmt.Errorf("iceflashprog: protocol: invalid request data length for report %d: %d", obj.requestId, l)
-		}
-		dataToSend = append([]byte{obj.data}, data...)
+	d.opm.Lock()
+	if d.op != nil {
+		d.opm.Unlock()
+		return nil, ErrLocked
 	}
+	d.op = o
+	d.opm.Unlock()
 
-	id, data, err := d.call(obj.requestId, dataToSend)
-	if err != nil {
+	if _, err := d.opCall(op, addr); err != nil {
+		d.opm.Lock()
+		d.op = nil
+		d.opm.Unlock()
 		return nil, err
 	}
-	if id != obj.responseId {
-		return nil, fmt.Errorf("iceflashprog: protocol: invalid report id for response: %d", obj.responseId)
+	return o, nil
+}
+
+func (d *Device) handleEvent(data []byte) error {
+	if l := len(data); l != 7 {
+		return fmt.Errorf("iceflashprog: protocol: invalid event data length for report %d: %d", reportEvent, l)
 	}
 
-	switch obj.responseId {
-	case reportFlashPage:
-		if l := len(data); l != FlashPageSize {
-			return nil, fmt.Errorf("iceflashprog: protocol: invalid response data length for report %d: %d", obj.responseId, l)
-		}
-		return data, nil
+	d.opm.Lock()
+	o := d.op
+	if o == nil || o.command != data[1] {
+		d.opm.Unlock()
+		return nil
+	}
 
-	case reportData:
-		if l := len(data); l != 4 {
-			return nil, fmt.Errorf("iceflashprog: protocol: invalid response data length for report %d: %d", obj.responseId, l)
-		}
+	value := uint32(data[3])<<24 | uint32(data[4])<<16 | uint32(data[5])<<8 | uint32(data[6])
 
-		err, ok := errorMap[data[0]]
-		if !ok {
-			return nil, fmt.Errorf("iceflashprog: protocol: unknown error: %d", data[0])
+	switch data[0] {
+	case eventProgress:
+		d.opm.Unlock()
+		if o.progress != nil {
+			o.progress(value)
 		}
-		if err != nil {
-			return nil, err
+
+	case eventStep:
+		d.opm.Unlock()
+		o.setStep(int(value))
+
+	case eventResult:
+		d.opm.Unlock()
+		o.addResult(value)
+
+	case eventComplete:
+		d.op = nil
+		d.opm.Unlock()
+
+		// failed jobs report the address where they stopped, instead of
+		// the elapsed time.
+		if err := statusError(data[2]); err == ErrJobFailed {
+			o.complete(0, fmt.Errorf("%w at address %#06x", err, value))
+		} else {
+			o.complete(time.Duration(value)*time.Millisecond, err)
 		}
 
-		return data[1:], nil
+	default:
+		d.opm.Unlock()
+	}
+	return nil
+}
+
+func (d *Device) opCall(op operation, addr uint32) ([]byte, error) {
+	obj, ok := operationMap[op]
+	if !ok || obj.requestId != reportData {
+		return nil, fmt.Errorf("iceflashprog: protocol: invalid operation: %d", op)
 	}
 
-	return nil, fmt.Errorf("iceflashprog: protocol: unknown error")
+	d.m.Lock()
+	defer d.m.Unlock()
+
+	return d.roundTrip(obj.requestId, obj.responseId, d.codec.encodeCommand(obj.data, addr))
+}
+
+func (d *Device) roundTrip(requestId report, responseId report, data []byte) ([]byte, error) {
+	id, data, err := d.call(requestId, data)
+	if err != nil {
+		return nil, err
+	}
+	return decodeResponse(responseId, id, data)
 }
 
 func (d *Device) PowerUp() error {
-	_, err := d.opCall(opPowerUp, []byte{0, 0, 0})
+	_, err := d.opCall(opPowerUp, 0)
 	return err
 }
 
 func (d *Device) PowerDown() error {
-	_, err := d.opCall(opPowerDown, []byte{0, 0, 0})
+	_, err := d.opCall(opPowerDown, 0)
 	if errors.Is(err, ErrUnpowered) {
 		return nil
 	}
 	return fmt.Errorf("iceflashprog: protocol: failed to power down")
 }
 
+// FlashSizeFromJedecId returns the flash memory size encoded in the capacity
+// byte of the JEDEC device ID, or 0 if unknown.
+func FlashSizeFromJedecId(devid uint16) uint32 {
+	switch c := byte(devid); {
+	case c >= 0x10 && c <= 0x19:
+		return 1 << c
+
+	// parts from 64MB and up continue the sequence from 0x20
+	case c >= 0x20 && c <= 0x22:
+		return 1 << (c - 6)
+	}
+	return 0
+}
+
 func (d *Device) GetJedecId() (byte, uint16, error) {
-	data, err := d.opCall(opJedecId, []byte{0, 0, 0})
+	data, err := d.opCall(opJedecId, 0)
 	if err != nil {
 		return 0, 0, err
 	}
-	return data[0], uint16(data[1])<<8 | uint16(data[2]), nil
+
+	devid := uint16(data[1])<<8 | uint16(data[2])
+	d.flashSize = FlashSizeFromJedecId(devid)
+	return data[0], devid, nil
 }
 
-func (d *Device) ReadFlashPage(addr uint32) ([]byte, error) {
-	data, err := d.opCall(opRead, []byte{byte(addr >> 16), byte(addr >> 8), byte(addr)})
-	if err != nil {
-		return nil, err
+// FlashSize returns the size of the flash memory detected by GetJedecId, or
+// DefaultFlashSize if it was not detected.
+func (d *Device) FlashSize() uint32 {
+	if d.flashSize == 0 {
+		return DefaultFlashSize
 	}
-	return data, nil
+	return d.flashSize
+}
+
+// ReadFlashPage reads a page from the flash memory. The returned slice is
+// owned by the caller.
+func (d *Device) ReadFlashPage(addr uint32) ([]byte, error) {
+	return d.opCall(opRead, addr)
 }
 
 func (d *Device) WriteFlashPage(addr uint32, data []byte) error {
-	if l := len(data); l > FlashPageSize {
-		return fmt.Errorf("iceflashprog: protocol: got more data to write to flash than one page: %d", l)
-	}
+	d.m.Lock()
+	defer d.m.Unlock()
 
-	data2 := slices.Clone(data)
-	for range FlashPageSize - len(data) {
-		data2 = append(data2, 0xff)
+	buf, err := d.codec.encodePage(addr, data)
+	if err != nil {
+		return err
 	}
-	_, err := d.opCall(opWrite, append([]byte{byte(addr >> 16), byte(addr >> 8), byte(addr)}, data2...))
+
+	_, err = d.roundTrip(reportFlashPage, reportData, buf)
 	return err
 }
 
+func (d *Device) EraseFlashSectorAsync(addr uint32, progress func(elapsed time.Duration)) (*Operation, error) {
+	return d.opCallAsync(opEraseSector, addr, elapsedProgress(progress))
+}
+
 func (d *Device) EraseFlashSector(addr uint32) error {
-	_, err := d.opCall(opEraseSector, []byte{byte(addr >> 16), byte(addr >> 8), byte(addr)})
-	return err
+	o, err := d.EraseFlashSectorAsync(addr, nil)
+	if err != nil {
+		return err
+	}
+	return o.Wait()
+}
+
+func (d *Device) EraseFlashBlockAsync(addr uint32, progress func(elapsed time.Duration)) (*Operation, error) {
+	return d.opCallAsync(opEraseBlock, addr, elapsedProgress(progress))
 }
 
 func (d *Device) EraseFlashBlock(addr uint32) error {
-	_, err := d.opCall(opEraseBlock, []byte{byte(addr >> 16), byte(addr >> 8), byte(addr)})
-	return err
+	o, err := d.EraseFlashBlockAsync(addr, nil)
+	if err != nil {
+		return err
+	}
+	return o.Wait()
+}
+
+func (d *Device) EraseChipAsync(progress func(elapsed time.Duration)) (*Operation, error) {
+	return d.opCallAsync(opEraseChip, 0, elapsedProgress(progress))
 }
 
 func (d *Device) EraseChip() error {
-	_, err := d.opCall(opEraseChip, []byte{0, 0, 0})
+	o, err := d.EraseChipAsync(nil)
+	if err != nil {
+		return err
+	}
+	return o.Wait()
+}
+
+// GetOperationStatus returns whether a long operation is still running on
+// the device, and the last value read from the flash status register.
+func (d *Device) GetOperationStatus() (bool, byte, error) {
+	data, err := d.opCall(opOperationStatus, 0)
+	if err != nil {
+		return false, 0, err
+	}
+	return data[0] != 0, data[1], nil
+}
+
+// SRAMStart puts the flash memory in deep power-down and resets the FPGA into
+// SPI slave configuration mode. Pages written with WriteSRAMPage are streamed
+// directly into the FPGA configuration memory, until SRAMFinish is called.
+func (d *Device) SRAMStart() error {
+	if !d.Capabilities().Has(FeatureSRAM) {
+		return ErrUnsupported
+	}
+
+	_, err := d.opCall(opSRAMStart, 0)
+	return err
+}
+
+func (d *Device) WriteSRAMPage(data []byte) error {
+	return d.WriteFlashPage(0, data)
+}
+
+// SRAMFinish sends the trailing dummy clocks required by the FPGA to start
+// the configured design. The flash memory is left powered down.
+func (d *Device) SRAMFinish() error {
+	_, err := d.opCall(opSRAMFinish, 0)
 	return err
 }
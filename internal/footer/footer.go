@@ -0,0 +1,167 @@
+package footer
+
+import (
+	"bytes"
+	"encoding/binary"
+	"errors"
+	"fmt"
+	"hash"
+	"hash/crc32"
+
+	"rafaelmartins.com/p/iceflashprog/internal/device"
+)
+
+const (
+	Magic   = "ICEFPFTR"
+	version = 1
+
+	// HeaderSize is the size of the footer without the sector hashes and
+	// its own CRC.
+	HeaderSize = len(Magic) + 4 + 4*4
+)
+
+var ErrInvalidFooter = errors.New("iceflashprog: footer: invalid footer")
+
+// Footer describes an image written to flash memory, with the CRC-32 (IEEE)
+// of each of its erase sectors, so that it can be verified on the device
+// without the original file. The CRC of the last sector only covers the
+// image data.
+type Footer struct {
+	Address uint32
+	Length  uint32
+	CRC     uint32
+	Sectors []uint32
+}
+
+// Address returns where the footer of an image ending at end is written:
+// the first erase sector after it.
+func Address(end uint32) uint32 {
+	return (end + device.FlashSectorSize - 1) &^ (device.FlashSectorSize - 1)
+}
+
+// Len returns the size of the footer whose header is at the start of data.
+func Len(data []byte) (int, error) {
+	if len(data) < HeaderSize || !bytes.HasPrefix(data, []byte(Magic)) {
+		return 0, fmt.Errorf("%w: magic not found", ErrInvalidFooter)
+	}
+	if data[len(Magic)] != version {
+		return 0, fmt.Errorf("%w: unsupported version: %d", ErrInvalidFooter, data[len(Magic)])
+	}
+
+	length := binary.BigEndian.Uint32(data[len(Magic)+8:])
+	sectors := (length + device.FlashSectorSize - 1) / device.FlashSectorSize
+	return HeaderSize + 4*int(sectors) + 4, nil
+}
+
+// Parse decodes a footer and checks its CRC.
+func Parse(data []byte) (*Footer, error) {
+	l, err := Len(data)
+	if err != nil {
+		return nil, err
+	}
+	if len(data) < l {
+		return nil, fmt.Errorf("%w: truncated", ErrInvalidFooter)
+	}
+	if crc32.ChecksumIEEE(data[:l-4]) != binary.BigEndian.Uint32(data[l-4:]) {
+		return nil, fmt.Errorf("%w: CRC mismatch", ErrInvalidFooter)
+	}
+
+	b := data[len(Magic)+4:]
+	rv := &Footer{
+		Address: binary.BigEndian.Uint32(b[0:]),
+		Length:  binary.BigEndian.Uint32(b[4:]),
+		CRC:     binary.BigEndian.Uint32(b[8:]),
+	}
+	if binary.BigEndian.Uint32(b[12:]) != device.FlashSectorSize {
+		return nil, fmt.Errorf("%w: unsupported sector size", ErrInvalidFooter)
+	}
+	if rv.Address%device.FlashSectorSize != 0 {
+		return nil, fmt.Errorf("%w: image not aligned to erase sector: %#x", ErrInvalidFooter, rv.Address)
+	}
+
+	for off := HeaderSize; off < l-4; off += 4 {
+		rv.Sectors = append(rv.Sectors, binary.BigEndian.Uint32(data[off:]))
+	}
+	return rv, nil
+}
+
+// Bytes encodes the footer, as written to flash memory.
+func (f *Footer) Bytes() []byte {
+	rv := make([]byte, HeaderSize, HeaderSize+4*len(f.Sectors)+4)
+	copy(rv, Magic)
+	rv[len(Magic)] = version
+
+	b := rv[len(Magic)+4:]
+	binary.BigEndian.PutUint32(b[0:], f.Address)
+	binary.BigEndian.PutUint32(b[4:], f.Length)
+	binary.BigEndian.PutUint32(b[8:], f.CRC)
+	binary.BigEndian.PutUint32(b[12:], device.FlashSectorSize)
+
+	for _, crc := range f.Sectors {
+		rv = binary.BigEndian.AppendUint32(rv, crc)
+	}
+	return binary.BigEndian.AppendUint32(rv, crc32.ChecksumIEEE(rv))
+}
+
+// Sector returns the address and length of the image data covered by the
+// sector hash with the given index.
+func (f *Footer) Sector(idx int) (uint32, uint32) {
+	off := uint32(idx) * device.FlashSectorSize
+	return f.Address + off, min(device.FlashSectorSize, f.Length-off)
+}
+
+// Writer calculates the footer of the data written to it, for images that
+// are only available as a stream.
+type Writer struct {
+	f      Footer
+	sector hash.Hash32
+	image  hash.Hash32
+	fill   uint32
+}
+
+// NewWriter returns a Writer for an image written at the given address,
+// aligned to an erase sector.
+func NewWriter(addr uint32) *Writer {
+	return &Writer{
+		f:      Footer{Address: addr},
+		sector: crc32.NewIEEE(),
+		image:  crc32.NewIEEE(),
+	}
+}
+
+func (w *Writer) Write(p []byte) (int, error) {
+	w.image.Write(p)
+	w.f.Length += uint32(len(p))
+
+	for rest := p; len(rest) > 0; {
+		n := min(uint32(len(rest)), device.FlashSectorSize-w.fill)
+		w.sector.Write(rest[:n])
+		w.fill += n
+		rest = rest[n:]
+
+		if w.fill == device.FlashSectorSize {
+			w.f.Sectors = append(w.f.Sectors, w.sector.Sum32())
+			w.sector.Reset()
+			w.fill = 0
+		}
+	}
+	return len(p), nil
+}
+
+// Footer returns the footer of the data written so far.
+func (w *Writer) Footer() *Footer {
+	rv := w.f
+	rv.CRC = w.image.Sum32()
+	rv.Sectors = append([]uint32(nil), w.f.Sectors...)
+	if w.fill > 0 {
+		rv.Sectors = append(rv.Sectors, w.sector.Sum32())
+	}
+	return &rv
+}
+
+// New returns the footer of an image written at the given address.
+func New(addr uint32, data []byte) *Footer {
+	w := NewWriter(addr)
+	w.Write(data)
+	return w.Footer()
+}
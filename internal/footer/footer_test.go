@@ -0,0 +1,112 @@
+package footer
+
+import (
+	"bytes"
+	"errors"
+	"hash/crc32"
+	"testing"
+
+	"rafaelmartins.com/p/iceflashprog/internal/device"
+)
+
+func TestFooterRoundTrip(t *testing.T) {
+	data := bytes.Repeat([]byte{1, 2, 3}, device.FlashSectorSize)
+	addr := uint32(device.FlashBlockSize)
+
+	f := New(addr, data)
+	if f.Address != addr || f.Length != uint32(len(data)) || f.CRC != crc32.ChecksumIEEE(data) {
+		t.Fatalf("invalid footer: %+v", f)
+	}
+	if len(f.Sectors) != 3 {
+		t.Fatalf("invalid sectors: %d", len(f.Sectors))
+	}
+
+	// the last sector only covers the image data.
+	a, l := f.Sector(2)
+	if a != addr+2*device.FlashSectorSize || l != uint32(len(data))-2*device.FlashSectorSize {
+		t.Fatalf("invalid last sector: %#x, %d", a, l)
+	}
+	if f.Sectors[2] != crc32.ChecksumIEEE(data[2*device.FlashSectorSize:]) {
+		t.Fatal("invalid last sector CRC")
+	}
+
+	b := f.Bytes()
+	if n, err := Len(b); err != nil || n != len(b) {
+		t.Fatalf("invalid length: %d, %v", n, err)
+	}
+
+	p, err := Parse(append(b, 0xff, 0xff))
+	if err != nil {
+		t.Fatal(err)
+	}
+	if p.Address != f.Address || p.Length != f.Length || p.CRC != f.CRC || len(p.Sectors) != len(f.Sectors) {
+		t.Fatalf("invalid parsed footer: %+v", p)
+	}
+	for i := range f.Sectors {
+		if p.Sectors[i] != f.Sectors[i] {
+			t.Fatalf("invalid parsed sector %d", i)
+		}
+	}
+}
+
+func TestWriter(t *testing.T) {
+	data := make([]byte, 2*device.FlashSectorSize+10)
+	for i := range data {
+		data[i] = byte(i)
+	}
+
+	// writes that don't match sector boundaries.
+	w := NewWriter(0)
+	for rest := data; len(rest) > 0; {
+		n := min(len(rest), 1000)
+		w.Write(rest[:n])
+		rest = rest[n:]
+	}
+
+	if !bytes.Equal(w.Footer().Bytes(), New(0, data).Bytes()) {
+		t.Fatal("streamed footer differs")
+	}
+
+	// the footer can be taken while writing.
+	if f := w.Footer(); len(f.Sectors) != 3 || len(w.Footer().Sectors) != 3 {
+		t.Fatal("footer changed by reading it")
+	}
+}
+
+func TestParseInvalid(t *testing.T) {
+	b := New(0, []byte{1, 2, 3}).Bytes()
+
+	bad := bytes.Clone(b)
+	bad[len(bad)-1] ^= 1
+
+	version := bytes.Clone(b)
+	version[len(Magic)]++
+
+	for name, data := range map[string][]byte{
+		"empty":       nil,
+		"magic":       append([]byte("ICEFPXXX"), b[len(Magic):]...),
+		"version":     version,
+		"truncated":   b[:len(b)-1],
+		"CRC":         bad,
+		"unaligned":   New(1, []byte{1}).Bytes(),
+		"no sector":   b[:HeaderSize-1],
+		"short magic": []byte(Magic[:4]),
+	} {
+		if _, err := Parse(data); !errors.Is(err, ErrInvalidFooter) {
+			t.Errorf("%s: expected invalid footer error, got %v", name, err)
+		}
+	}
+}
+
+func TestAddress(t *testing.T) {
+	for end, addr := range map[uint32]uint32{
+		0:                          0,
+		1:                          device.FlashSectorSize,
+		device.FlashSectorSize:     device.FlashSectorSize,
+		device.FlashSectorSize + 1: 2 * device.FlashSectorSize,
+	} {
+		if a := Address(end); a != addr {
+			t.Errorf("%#x: invalid address: %#x", end, a)
+		}
+	}
+}
@@ -0,0 +1,32 @@
+package hotplug
+
+import (
+	"time"
+)
+
+// pollInterval is used on systems without hotplug notifications.
+const pollInterval = time.Second
+
+func notify(c chan struct{}) {
+	select {
+	case c <- struct{}{}:
+	default:
+	}
+}
+
+func poll(c chan struct{}) {
+	for range time.Tick(pollInterval) {
+		notify(c)
+	}
+}
+
+// Watch returns a channel that receives a value whenever USB HID devices may
+// have been connected or disconnected, and should be enumerated again.
+// Notifications are coalesced, and the first one is sent right away, for the
+// devices already connected.
+func Watch() <-chan struct{} {
+	c := make(chan struct{}, 1)
+	notify(c)
+	go watch(c)
+	return c
+}
@@ -0,0 +1,59 @@
+package hotplug
+
+import (
+	"bytes"
+	"syscall"
+)
+
+// udevGroup is the netlink multicast group of the events sent by udev, after
+// the device nodes are created and their permissions are set. Kernel events
+// (group 1) arrive before that, and opening the device could fail.
+const udevGroup = 2
+
+func isHidrawEvent(msg []byte) bool {
+	subsystem, action := false, false
+	for _, f := range bytes.Split(msg, []byte{0}) {
+		switch {
+		case bytes.Equal(f, []byte("SUBSYSTEM=hidraw")):
+			subsystem = true
+		case bytes.Equal(f, []byte("ACTION=add")), bytes.Equal(f, []byte("ACTION=remove")):
+			action = true
+		}
+	}
+	return subsystem && action
+}
+
+func watch(c chan struct{}) {
+	fd, err := syscall.Socket(syscall.AF_NETLINK, syscall.SOCK_RAW|syscall.SOCK_CLOEXEC, syscall.NETLINK_KOBJECT_UEVENT)
+	if err != nil {
+		poll(c)
+		return
+	}
+	defer syscall.Close(fd)
+
+	if err := syscall.Bind(fd, &syscall.SockaddrNetlink{Family: syscall.AF_NETLINK, Groups: udevGroup}); err != nil {
+		poll(c)
+		return
+	}
+
+	buf := make([]byte, 8192)
+	for {
+		n, _, err := syscall.Recvfrom(fd, buf, 0)
+		switch err {
+		case nil:
+			if isHidrawEvent(buf[:n]) {
+				notify(c)
+			}
+
+		case syscall.EINTR:
+
+		case syscall.ENOBUFS:
+			// events were dropped, enumerate again to catch up.
+			notify(c)
+
+		default:
+			poll(c)
+			return
+		}
+	}
+}
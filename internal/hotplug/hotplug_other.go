@@ -0,0 +1,7 @@
+//go:build !linux
+
+package hotplug
+
+func watch(c chan struct{}) {
+	poll(c)
+}
@@ -0,0 +1,184 @@
+package identify
+
+import (
+	"bytes"
+	"errors"
+	"hash/crc32"
+	"os"
+	"path/filepath"
+	"slices"
+
+	"rafaelmartins.com/p/iceflashprog/internal/bitstream"
+	"rafaelmartins.com/p/iceflashprog/internal/device"
+)
+
+var ErrNoImages = errors.New("iceflashprog: identify: no images found")
+
+// Image is a known bitstream, with the CRC-32 (IEEE) of each erase sector it
+// touches, padded with erased bytes as written to flash memory.
+type Image struct {
+	Name    string
+	Size    uint32
+	CRC     uint32
+	Sectors []uint32
+}
+
+func newImage(name string, data []byte) *Image {
+	rv := &Image{
+		Name: name,
+		Size: uint32(len(data)),
+		CRC:  crc32.ChecksumIEEE(data),
+	}
+
+	for off := 0; off < len(data); off += device.FlashSectorSize {
+		sector := data[off:min(off+device.FlashSectorSize, len(data))]
+		if len(sector) < device.FlashSectorSize {
+			sector = append(slices.Clone(sector), bytes.Repeat([]byte{0xff}, device.FlashSectorSize-len(sector))...)
+		}
+		rv.Sectors = append(rv.Sectors, crc32.ChecksumIEEE(sector))
+	}
+	return rv
+}
+
+// Load reads every regular file in the directory as a bitstream.
+func Load(dir string) ([]*Image, error) {
+	entries, err := os.ReadDir(dir)
+	if err != nil {
+		return nil, err
+	}
+
+	rv := []*Image{}
+	for _, e := range entries {
+		if !e.Type().IsRegular() {
+			continue
+		}
+
+		bs, err := bitstream.New(filepath.Join(dir, e.Name()))
+		if err != nil {
+			return nil, err
+		}
+
+		// sparse dumps are compared with the whole flash memory content.
+		data := bs.Bytes()
+		if bs.IsSparse() {
+			data = make([]byte, bs.Size())
+			bs.ReadAt(data, 0)
+		}
+		bs.Close()
+
+		if len(data) > 0 {
+			rv = append(rv, newImage(e.Name(), data))
+		}
+	}
+
+	if len(rv) == 0 {
+		return nil, ErrNoImages
+	}
+	return rv, nil
+}
+
+// Result is the outcome of Identify. Matches are the images consistent with
+// every sector queried, more than one if their content is the same. Closest
+// is the image that matched the most queried sectors.
+type Result struct {
+	Matches []*Image
+	Closest *Image
+	Queries int
+}
+
+// sector returns the expected CRC of the sector with the given index, or
+// false if the image does not touch it.
+func (img *Image) sector(idx int) (uint32, bool) {
+	if idx >= len(img.Sectors) {
+		return 0, false
+	}
+	return img.Sectors[idx], true
+}
+
+// split returns the size of the largest group of images that can't be told
+// apart by querying the sector. Images that don't touch the sector belong to
+// every group.
+func split(images []*Image, idx int) int {
+	groups := map[uint32]int{}
+	wildcards := 0
+	for _, img := range images {
+		if crc, ok := img.sector(idx); ok {
+			groups[crc]++
+		} else {
+			wildcards++
+		}
+	}
+
+	rv := 0
+	for _, n := range groups {
+		rv = max(rv, n)
+	}
+	return rv + wildcards
+}
+
+// Identify finds which of the images is in flash memory, querying the CRC of
+// as few erase sectors as possible: each query is the sector that best splits
+// the images still matching. query returns the CRC of the sector with the
+// given index.
+func Identify(images []*Image, query func(idx int) (uint32, error)) (*Result, error) {
+	if len(images) == 0 {
+		return nil, ErrNoImages
+	}
+
+	sectors := 0
+	for _, img := range images {
+		sectors = max(sectors, len(img.Sectors))
+	}
+
+	rv := &Result{}
+	matches := slices.Clone(images)
+	score := map[*Image]int{}
+	queried := map[int]bool{}
+
+	for len(matches) > 1 {
+		best, bestSize := -1, len(matches)
+		for idx := 0; idx < sectors; idx++ {
+			if queried[idx] {
+				continue
+			}
+			if size := split(matches, idx); size < bestSize {
+				best, bestSize = idx, size
+			}
+		}
+
+		// the images left have the same content.
+		if best < 0 {
+			break
+		}
+
+		crc, err := query(best)
+		if err != nil {
+			return nil, err
+		}
+		queried[best] = true
+		rv.Queries++
+
+		for _, img := range images {
+			if c, ok := img.sector(best); ok && c == crc {
+				score[img]++
+			}
+		}
+
+		matches = slices.DeleteFunc(matches, func(img *Image) bool {
+			c, ok := img.sector(best)
+			return ok && c != crc
+		})
+	}
+
+	rv.Matches = matches
+	rv.Closest = images[0]
+	for _, img := range images {
+		if score[img] > score[rv.Closest] {
+			rv.Closest = img
+		}
+	}
+	if len(matches) > 0 {
+		rv.Closest = matches[0]
+	}
+	return rv, nil
+}
@@ -0,0 +1,112 @@
+package identify
+
+import (
+	"bytes"
+	"errors"
+	"hash/crc32"
+	"os"
+	"path/filepath"
+	"testing"
+
+	"rafaelmartins.com/p/iceflashprog/internal/device"
+)
+
+// testImage returns an image whose sectors are filled with the given bytes.
+func testImage(fill ...byte) []byte {
+	rv := []byte{}
+	for _, b := range fill {
+		rv = append(rv, bytes.Repeat([]byte{b}, device.FlashSectorSize)...)
+	}
+	return rv
+}
+
+func testQuery(t *testing.T, flash []byte) func(idx int) (uint32, error) {
+	return func(idx int) (uint32, error) {
+		off := idx * device.FlashSectorSize
+		if off >= len(flash) {
+			t.Fatalf("query out of range: %d", idx)
+		}
+		return crc32.ChecksumIEEE(flash[off : off+device.FlashSectorSize]), nil
+	}
+}
+
+func TestNewImage(t *testing.T) {
+	data := testImage(1)[:100]
+	img := newImage("a", data)
+	if img.Size != 100 || img.CRC != crc32.ChecksumIEEE(data) || len(img.Sectors) != 1 {
+		t.Fatalf("invalid image: %+v", img)
+	}
+
+	// short sectors are padded with erased bytes.
+	padded := append(bytes.Clone(data), bytes.Repeat([]byte{0xff}, device.FlashSectorSize-100)...)
+	if img.Sectors[0] != crc32.ChecksumIEEE(padded) {
+		t.Fatal("invalid padded sector CRC")
+	}
+}
+
+func TestIdentify(t *testing.T) {
+	images := []*Image{
+		newImage("a", testImage(1, 2, 3)),
+		newImage("b", testImage(1, 2, 4)),
+		newImage("c", testImage(1, 5, 3)),
+		newImage("d", testImage(6)),
+	}
+
+	flash := append(testImage(1, 2, 4), testImage(0xff)...)
+	res, err := Identify(images, testQuery(t, flash))
+	if err != nil {
+		t.Fatal(err)
+	}
+	if len(res.Matches) != 1 || res.Matches[0].Name != "b" || res.Closest.Name != "b" {
+		t.Fatalf("invalid result: %+v", res)
+	}
+	if res.Queries > 3 {
+		t.Fatalf("too many queries: %d", res.Queries)
+	}
+
+	// nothing matches, the closest image shares the most sectors.
+	flash = testImage(1, 2, 7, 0xff)
+	res, err = Identify(images, testQuery(t, flash))
+	if err != nil {
+		t.Fatal(err)
+	}
+	if len(res.Matches) != 0 || res.Closest.Name != "a" {
+		t.Fatalf("invalid result: %d matches, closest %s", len(res.Matches), res.Closest.Name)
+	}
+
+	// images with the same content can't be told apart.
+	same := []*Image{newImage("a", testImage(1)), newImage("b", testImage(1))}
+	res, err = Identify(same, testQuery(t, testImage(1)))
+	if err != nil {
+		t.Fatal(err)
+	}
+	if len(res.Matches) != 2 || res.Queries != 0 {
+		t.Fatalf("invalid result: %d matches, %d queries", len(res.Matches), res.Queries)
+	}
+
+	if _, err := Identify(nil, testQuery(t, nil)); !errors.Is(err, ErrNoImages) {
+		t.Fatalf("expected no images error, got %v", err)
+	}
+}
+
+func TestLoad(t *testing.T) {
+	dir := t.TempDir()
+	if _, err := Load(dir); !errors.Is(err, ErrNoImages) {
+		t.Fatalf("expected no images error, got %v", err)
+	}
+
+	if err := os.WriteFile(filepath.Join(dir, "a.bin"), testImage(1, 2), 0666); err != nil {
+		t.Fatal(err)
+	}
+	if err := os.Mkdir(filepath.Join(dir, "sub"), 0777); err != nil {
+		t.Fatal(err)
+	}
+
+	images, err := Load(dir)
+	if err != nil {
+		t.Fatal(err)
+	}
+	if len(images) != 1 || images[0].Name != "a.bin" || len(images[0].Sectors) != 2 {
+		t.Fatalf("invalid images: %+v", images)
+	}
+}
@@ -0,0 +1,230 @@
+package layout
+
+import (
+	"bufio"
+	"errors"
+	"fmt"
+	"os"
+	"path/filepath"
+	"strconv"
+	"strings"
+
+	"rafaelmartins.com/p/iceflashprog/internal/device"
+	"rafaelmartins.com/p/iceflashprog/internal/plan"
+)
+
+const (
+	// MaxImages is the number of images supported by iCE40 warmboot.
+	MaxImages = 4
+
+	headerEntrySize = 32
+	headerEntries   = MaxImages + 1 // power-on image, plus one per warmboot image
+	HeaderSize      = headerEntries * headerEntrySize
+)
+
+var ErrInvalidLayout = errors.New("iceflashprog: layout: invalid layout")
+
+type Image struct {
+	Name    string
+	File    string
+	Address uint32
+	Data    []byte
+}
+
+// Layout describes a multi-image flash memory, with a warmboot header at
+// address 0, in the same format generated by icemulti.
+type Layout struct {
+	Images   []*Image
+	Boot     int
+	ColdBoot bool
+}
+
+// Parse reads a layout spec, one directive per line:
+//
+//	image <name> <file> [address]
+//	boot <name>
+//	coldboot
+//
+// Images are numbered for warmboot in the order they are declared. Images
+// without an address are placed at the next block boundary after the
+// previous one. Relative file paths are resolved from the spec directory.
+func Parse(file string) (*Layout, error) {
+	fp, err := os.Open(file)
+	if err != nil {
+		return nil, err
+	}
+	defer fp.Close()
+
+	rv := &Layout{}
+	boot := ""
+	next := uint32(device.FlashBlockSize)
+
+	s := bufio.NewScanner(fp)
+	for line := 1; s.Scan(); line++ {
+		f := strings.Fields(s.Text())
+		if len(f) == 0 || strings.HasPrefix(f[0], "#") {
+			continue
+		}
+
+		switch {
+		case f[0] == "image" && (len(f) == 3 || len(f) == 4):
+			img := &Image{
+				Name: f[1],
+				File: f[2],
+			}
+			if !filepath.IsAbs(img.File) {
+				img.File = filepath.Join(filepath.Dir(file), img.File)
+			}
+
+			img.Data, err = os.ReadFile(img.File)
+			if err != nil {
+				return nil, err
+			}
+
+			img.Address = next
+			if len(f) == 4 {
+				addr, err := strconv.ParseUint(f[3], 0, 32)
+				if err != nil {
+					return nil, fmt.Errorf("%w: %s:%d: %w", ErrInvalidLayout, file, line, err)
+				}
+				img.Address = uint32(addr)
+			}
+			next = alignUp(img.Address+uint32(len(img.Data)), device.FlashBlockSize)
+
+			rv.Images = append(rv.Images, img)
+
+		case f[0] == "boot" && len(f) == 2:
+			boot = f[1]
+
+		case f[0] == "coldboot" && len(f) == 1:
+			rv.ColdBoot = true
+
+		default:
+			return nil, fmt.Errorf("%w: %s:%d: invalid directive: %s", ErrInvalidLayout, file, line, s.Text())
+		}
+	}
+	if err := s.Err(); err != nil {
+		return nil, err
+	}
+
+	if boot != "" {
+		rv.Boot = -1
+		for i, img := range rv.Images {
+			if img.Name == boot {
+				rv.Boot = i
+			}
+		}
+		if rv.Boot < 0 {
+			return nil, fmt.Errorf("%w: boot image not found: %s", ErrInvalidLayout, boot)
+		}
+	}
+
+	if err := rv.validate(); err != nil {
+		return nil, err
+	}
+	return rv, nil
+}
+
+func alignUp(v uint32, a uint32) uint32 {
+	return (v + a - 1) &^ (a - 1)
+}
+
+func (l *Layout) validate() error {
+	if len(l.Images) == 0 || len(l.Images) > MaxImages {
+		return fmt.Errorf("%w: expected 1 to %d images, got %d", ErrInvalidLayout, MaxImages, len(l.Images))
+	}
+
+	for i, img := range l.Images {
+		if img.Address%device.FlashSectorSize != 0 {
+			return fmt.Errorf("%w: image %s: address not aligned to erase sector: %#x", ErrInvalidLayout, img.Name, img.Address)
+		}
+		if img.Address < device.FlashSectorSize {
+			return fmt.Errorf("%w: image %s: overlaps warmboot header", ErrInvalidLayout, img.Name)
+		}
+		if len(img.Data) == 0 {
+			return fmt.Errorf("%w: image %s: empty", ErrInvalidLayout, img.Name)
+		}
+
+		for _, other := range l.Images[:i] {
+			if other.Name == img.Name {
+				return fmt.Errorf("%w: duplicated image name: %s", ErrInvalidLayout, img.Name)
+			}
+
+			// images are erased by whole sectors
+			if img.Address < alignUp(other.Address+uint32(len(other.Data)), device.FlashSectorSize) &&
+				other.Address < alignUp(img.Address+uint32(len(img.Data)), device.FlashSectorSize) {
+				return fmt.Errorf("%w: images overlap: %s, %s", ErrInvalidLayout, other.Name, img.Name)
+			}
+		}
+	}
+	return nil
+}
+
+// Size returns the amount of flash memory needed by the layout.
+func (l *Layout) Size() uint32 {
+	rv := uint32(HeaderSize)
+	for _, img := range l.Images {
+		rv = max(rv, img.Address+uint32(len(img.Data)))
+	}
+	return rv
+}
+
+func (l *Layout) Image(name string) *Image {
+	for _, img := range l.Images {
+		if img.Name == name {
+			return img
+		}
+	}
+	return nil
+}
+
+func headerEntry(b []byte, addr uint32, coldBoot bool) {
+	copy(b, []byte{
+		0x7e, 0xaa, 0x99, 0x7e, // preamble
+		0x92, 0x00, 0x00, // boot mode
+		0x44, 0x03, byte(addr >> 16), byte(addr >> 8), byte(addr), // boot address
+		0x82, 0x00, 0x00, // bank offset
+		0x01, 0x08, // reboot
+	})
+	if coldBoot {
+		b[6] = 0x10
+	}
+}
+
+// Header returns the warmboot header: the power-on image entry, followed by
+// one entry per warmboot image. Unused warmboot entries point to the
+// power-on image.
+func (l *Layout) Header() []byte {
+	rv := make([]byte, HeaderSize)
+
+	headerEntry(rv, l.Images[l.Boot].Address, l.ColdBoot)
+	for i := range MaxImages {
+		img := l.Images[l.Boot]
+		if i < len(l.Images) {
+			img = l.Images[i]
+		}
+		headerEntry(rv[(i+1)*headerEntrySize:], img.Address, false)
+	}
+	return rv
+}
+
+// Regions returns the flash regions to be programmed: the warmboot header,
+// followed by the given images, or all images if none given.
+func (l *Layout) Regions(names ...string) ([]plan.Region, error) {
+	rv := []plan.Region{{Name: "header", Address: 0, Data: l.Header()}}
+
+	if len(names) == 0 {
+		for _, img := range l.Images {
+			names = append(names, img.Name)
+		}
+	}
+
+	for _, name := range names {
+		img := l.Image(name)
+		if img == nil {
+			return nil, fmt.Errorf("%w: image not found: %s", ErrInvalidLayout, name)
+		}
+		rv = append(rv, plan.Region{Name: img.Name, Address: img.Address, Data: img.Data})
+	}
+	return rv, nil
+}
@@ -0,0 +1,103 @@
+package layout
+
+import (
+	"errors"
+	"os"
+	"path/filepath"
+	"strings"
+	"testing"
+
+	"rafaelmartins.com/p/iceflashprog/internal/device"
+)
+
+func writeSpec(t *testing.T, spec string, files map[string]int) string {
+	dir := t.TempDir()
+	for name, size := range files {
+		if err := os.WriteFile(filepath.Join(dir, name), make([]byte, size), 0666); err != nil {
+			t.Fatal(err)
+		}
+	}
+
+	rv := filepath.Join(dir, "layout.txt")
+	if err := os.WriteFile(rv, []byte(spec), 0666); err != nil {
+		t.Fatal(err)
+	}
+	return rv
+}
+
+func TestParse(t *testing.T) {
+	file := writeSpec(t, strings.Join([]string{
+		"# images",
+		"image gold gold.bin",
+		"image app app.bin",
+		"image test app.bin 0x100000",
+		"boot app",
+		"coldboot",
+	}, "\n"), map[string]int{
+		"gold.bin": device.FlashBlockSize + 1,
+		"app.bin":  10,
+	})
+
+	l, err := Parse(file)
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	if len(l.Images) != 3 || l.Boot != 1 || !l.ColdBoot {
+		t.Fatalf("invalid layout: %d images, boot %d", len(l.Images), l.Boot)
+	}
+	for i, addr := range []uint32{device.FlashBlockSize, 3 * device.FlashBlockSize, 0x100000} {
+		if l.Images[i].Address != addr {
+			t.Fatalf("invalid image %d address: %#x", i, l.Images[i].Address)
+		}
+	}
+	if l.Size() != 0x100000+10 {
+		t.Fatalf("invalid size: %#x", l.Size())
+	}
+
+	h := l.Header()
+	if len(h) != HeaderSize {
+		t.Fatalf("invalid header size: %d", len(h))
+	}
+	for i, addr := range []uint32{3 * device.FlashBlockSize, device.FlashBlockSize, 3 * device.FlashBlockSize, 0x100000, 3 * device.FlashBlockSize} {
+		e := h[i*headerEntrySize:]
+		if got := uint32(e[9])<<16 | uint32(e[10])<<8 | uint32(e[11]); got != addr {
+			t.Fatalf("invalid header entry %d address: %#x", i, got)
+		}
+	}
+	if h[6] != 0x10 || h[headerEntrySize+6] != 0 {
+		t.Fatal("invalid cold boot flag")
+	}
+
+	rs, err := l.Regions("test")
+	if err != nil {
+		t.Fatal(err)
+	}
+	if len(rs) != 2 || rs[0].Name != "header" || rs[1].Name != "test" || rs[1].Address != 0x100000 {
+		t.Fatalf("invalid regions: %+v", rs)
+	}
+	if _, err := l.Regions("missing"); !errors.Is(err, ErrInvalidLayout) {
+		t.Fatalf("expected invalid layout, got %v", err)
+	}
+}
+
+func TestParseInvalid(t *testing.T) {
+	files := map[string]int{"a.bin": 10, "empty.bin": 0}
+
+	for name, spec := range map[string]string{
+		"no images":   "coldboot",
+		"directive":   "image a",
+		"address":     "image a a.bin foo",
+		"unaligned":   "image a a.bin 0x10100",
+		"header":      "image a a.bin 0",
+		"empty":       "image a empty.bin",
+		"duplicated":  "image a a.bin\nimage a a.bin",
+		"overlap":     "image a a.bin 0x10000\nimage b a.bin 0x10000",
+		"boot":        "image a a.bin\nboot b",
+		"many images": "image a a.bin\nimage b a.bin\nimage c a.bin\nimage d a.bin\nimage e a.bin",
+	} {
+		if _, err := Parse(writeSpec(t, spec, files)); !errors.Is(err, ErrInvalidLayout) {
+			t.Errorf("%s: expected invalid layout error, got %v", name, err)
+		}
+	}
+}
@@ -0,0 +1,120 @@
+package manifest
+
+import (
+	"bufio"
+	"errors"
+	"fmt"
+	"os"
+	"path/filepath"
+	"strconv"
+	"strings"
+
+	"rafaelmartins.com/p/iceflashprog/internal/plan"
+)
+
+var ErrInvalidManifest = errors.New("iceflashprog: manifest: invalid manifest")
+
+func parseErase(s string) (bool, error) {
+	switch s {
+	case "auto":
+		return true, nil
+	case "none":
+		return false, nil
+	}
+	return false, fmt.Errorf("invalid erase policy: %s", s)
+}
+
+// Parse reads a manifest, one directive per line:
+//
+//	verify <page|range|none>
+//	erase <auto|none>
+//	file <file> <address> [verify=<policy>] [erase=<policy>]
+//
+// verify and erase set the policies of the files listed after them, and the
+// file options override them for a single file. The initial policies are the
+// given ones. Relative file paths are resolved from the manifest directory.
+func Parse(file string, verify plan.Verify, erase bool) ([]plan.Region, error) {
+	fp, err := os.Open(file)
+	if err != nil {
+		return nil, err
+	}
+	defer fp.Close()
+
+	rv := []plan.Region{}
+
+	s := bufio.NewScanner(fp)
+	for line := 1; s.Scan(); line++ {
+		f := strings.Fields(s.Text())
+		if len(f) == 0 || strings.HasPrefix(f[0], "#") {
+			continue
+		}
+
+		invalid := func(err error) error {
+			return fmt.Errorf("%w: %s:%d: %w", ErrInvalidManifest, file, line, err)
+		}
+
+		switch {
+		case f[0] == "verify" && len(f) == 2:
+			verify, err = plan.ParseVerify(f[1])
+			if err != nil {
+				return nil, invalid(err)
+			}
+
+		case f[0] == "erase" && len(f) == 2:
+			erase, err = parseErase(f[1])
+			if err != nil {
+				return nil, invalid(err)
+			}
+
+		case f[0] == "file" && len(f) >= 3:
+			r := plan.Region{
+				Name:   f[1],
+				Verify: verify,
+				Erase:  erase,
+			}
+
+			addr, err := strconv.ParseUint(f[2], 0, 32)
+			if err != nil {
+				return nil, invalid(err)
+			}
+			r.Address = uint32(addr)
+
+			for _, opt := range f[3:] {
+				k, v, _ := strings.Cut(opt, "=")
+				switch k {
+				case "verify":
+					r.Verify, err = plan.ParseVerify(v)
+				case "erase":
+					r.Erase, err = parseErase(v)
+				default:
+					err = fmt.Errorf("invalid file option: %s", opt)
+				}
+				if err != nil {
+					return nil, invalid(err)
+				}
+			}
+
+			path := f[1]
+			if !filepath.IsAbs(path) {
+				path = filepath.Join(filepath.Dir(file), path)
+			}
+			r.Data, err = os.ReadFile(path)
+			if err != nil {
+				return nil, err
+			}
+
+			rv = append(rv, r)
+
+		default:
+			return nil, fmt.Errorf("%w: %s:%d: invalid directive: %s", ErrInvalidManifest, file, line, s.Text())
+		}
+	}
+	if err := s.Err(); err != nil {
+		return nil, err
+	}
+
+	if len(rv) == 0 {
+		return nil, fmt.Errorf("%w: %s: no files", ErrInvalidManifest, file)
+	}
+	return rv, nil
+}
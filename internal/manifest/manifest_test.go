@@ -0,0 +1,76 @@
+package manifest
+
+import (
+	"errors"
+	"os"
+	"path/filepath"
+	"strings"
+	"testing"
+
+	"rafaelmartins.com/p/iceflashprog/internal/plan"
+)
+
+func writeManifest(t *testing.T, manifest string) string {
+	dir := t.TempDir()
+	for _, name := range []string{"a.bin", "b.bin"} {
+		if err := os.WriteFile(filepath.Join(dir, name), []byte(name), 0666); err != nil {
+			t.Fatal(err)
+		}
+	}
+
+	rv := filepath.Join(dir, "manifest.txt")
+	if err := os.WriteFile(rv, []byte(manifest), 0666); err != nil {
+		t.Fatal(err)
+	}
+	return rv
+}
+
+func TestParse(t *testing.T) {
+	file := writeManifest(t, strings.Join([]string{
+		"# policies",
+		"file a.bin 0x0",
+		"verify range",
+		"erase none",
+		"file b.bin 0x10000",
+		"file a.bin 0x20000 verify=none erase=auto",
+	}, "\n"))
+
+	rs, err := Parse(file, plan.VerifyPage, true)
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	want := []plan.Region{
+		{Name: "a.bin", Address: 0, Data: []byte("a.bin"), Verify: plan.VerifyPage, Erase: true},
+		{Name: "b.bin", Address: 0x10000, Data: []byte("b.bin"), Verify: plan.VerifyRange, Erase: false},
+		{Name: "a.bin", Address: 0x20000, Data: []byte("a.bin"), Verify: plan.VerifyNone, Erase: true},
+	}
+	if len(rs) != len(want) {
+		t.Fatalf("invalid regions: %d", len(rs))
+	}
+	for i, r := range rs {
+		w := want[i]
+		if r.Name != w.Name || r.Address != w.Address || string(r.Data) != string(w.Data) || r.Verify != w.Verify || r.Erase != w.Erase {
+			t.Fatalf("invalid region %d: %+v", i, r)
+		}
+	}
+}
+
+func TestParseInvalid(t *testing.T) {
+	for name, manifest := range map[string]string{
+		"empty":     "# nothing",
+		"directive": "foo",
+		"address":   "file a.bin foo",
+		"verify":    "verify foo\nfile a.bin 0",
+		"erase":     "erase foo\nfile a.bin 0",
+		"option":    "file a.bin 0 foo=bar",
+	} {
+		if _, err := Parse(writeManifest(t, manifest), plan.VerifyPage, true); !errors.Is(err, ErrInvalidManifest) {
+			t.Errorf("%s: expected invalid manifest error, got %v", name, err)
+		}
+	}
+
+	if _, err := Parse(writeManifest(t, "file c.bin 0"), plan.VerifyPage, true); !errors.Is(err, os.ErrNotExist) {
+		t.Fatalf("expected missing file error, got %v", err)
+	}
+}
@@ -0,0 +1,188 @@
+package plan
+
+import (
+	"encoding/json"
+	"errors"
+	"io/fs"
+	"os"
+	"path/filepath"
+	"time"
+
+	"rafaelmartins.com/p/iceflashprog/internal/device"
+)
+
+// Model estimates how long the device takes to run each kind of step, for
+// a given flash memory part.
+type Model struct {
+	SectorErase time.Duration `json:"sector_erase"`
+	BlockErase  time.Duration `json:"block_erase"`
+	ChipErase   time.Duration `json:"chip_erase"`
+
+	// ProgramPage includes the USB transfer of the page, PageVerify is the
+	// extra time to read it back.
+	ProgramPage time.Duration `json:"program_page"`
+	PageVerify  time.Duration `json:"page_verify"`
+
+	// CRCPage is the time to calculate the CRC of a page on the device.
+	CRCPage time.Duration `json:"crc_page"`
+
+	// JobOverhead is the fixed cost of uploading and starting a job.
+	JobOverhead time.Duration `json:"job_overhead"`
+}
+
+// DefaultModel uses typical datasheet timings for 64 Mbit SPI NOR parts,
+// and is used for parts not calibrated yet.
+func DefaultModel(flashSize uint32) *Model {
+	return &Model{
+		SectorErase: 45 * time.Millisecond,
+		BlockErase:  150 * time.Millisecond,
+		ChipErase:   time.Duration(flashSize/device.FlashBlockSize) * 100 * time.Millisecond,
+		ProgramPage: time.Millisecond,
+		PageVerify:  300 * time.Microsecond,
+		CRCPage:     200 * time.Microsecond,
+		JobOverhead: 5 * time.Millisecond,
+	}
+}
+
+func pages(length uint32) time.Duration {
+	return time.Duration((length + device.FlashPageSize - 1) / device.FlashPageSize)
+}
+
+func (m *Model) step(s device.JobStep) time.Duration {
+	switch s.Op {
+	case device.JobEraseSector:
+		return time.Duration(s.Length/device.FlashSectorSize) * m.SectorErase
+	case device.JobEraseBlock:
+		return time.Duration(s.Length/device.FlashBlockSize) * m.BlockErase
+	case device.JobProgram:
+		return pages(s.Length) * (m.ProgramPage + m.PageVerify)
+	case device.JobProgramNoVerify:
+		return pages(s.Length) * m.ProgramPage
+	case device.JobCRC:
+		return pages(s.Length) * m.CRCPage
+	}
+	return 0
+}
+
+// Estimate returns how long the jobs are expected to take.
+func (m *Model) Estimate(jobs []Job) time.Duration {
+	rv := time.Duration(0)
+	for _, job := range jobs {
+		rv += m.JobOverhead
+		for _, s := range job {
+			rv += m.step(s.JobStep)
+		}
+	}
+	return rv
+}
+
+func update(v *time.Duration, measured time.Duration) {
+	if measured > 0 {
+		*v = (*v + measured) / 2
+	}
+}
+
+// Calibrate updates the model with the measured durations of the steps of
+// a job, as returned by device.Operation.StepDurations.
+func (m *Model) Calibrate(job Job, durations []time.Duration) {
+	for i, d := range durations {
+		if i >= len(job) {
+			break
+		}
+
+		s := job[i]
+		switch s.Op {
+		case device.JobEraseSector:
+			update(&m.SectorErase, d/time.Duration(s.Length/device.FlashSectorSize))
+		case device.JobEraseBlock:
+			update(&m.BlockErase, d/time.Duration(s.Length/device.FlashBlockSize))
+		case device.JobProgram:
+			update(&m.PageVerify, d/pages(s.Length)-m.ProgramPage)
+		case device.JobProgramNoVerify:
+			update(&m.ProgramPage, d/pages(s.Length))
+		case device.JobCRC:
+			update(&m.CRCPage, d/pages(s.Length))
+		}
+	}
+}
+
+func (m *Model) CalibrateChipErase(d time.Duration) {
+	update(&m.ChipErase, d)
+}
+
+func modelsFile() (string, error) {
+	dir, err := os.UserCacheDir()
+	if err != nil {
+		return "", err
+	}
+	return filepath.Join(dir, "iceflashprog", "timings.json"), nil
+}
+
+func loadModels() (map[string]*Model, error) {
+	f, err := modelsFile()
+	if err != nil {
+		return nil, err
+	}
+
+	rv := map[string]*Model{}
+	data, err := os.ReadFile(f)
+	if err != nil {
+		if errors.Is(err, fs.ErrNotExist) {
+			return rv, nil
+		}
+		return nil, err
+	}
+	if err := json.Unmarshal(data, &rv); err != nil {
+		return nil, err
+	}
+	return rv, nil
+}
+
+// LoadModel returns the model calibrated for the part identified by the
+// JEDEC ID, or the default model.
+func LoadModel(jedecId string, flashSize uint32) *Model {
+	if models, err := loadModels(); err == nil {
+		if m, ok := models[jedecId]; ok && m != nil {
+			return m
+		}
+	}
+	return DefaultModel(flashSize)
+}
+
+// SaveModel stores the calibrated model in the user cache directory.
+func SaveModel(jedecId string, m *Model) error {
+	models, err := loadModels()
+	if err != nil {
+		models = map[string]*Model{}
+	}
+	models[jedecId] = m
+
+	data, err := json.MarshalIndent(models, "", "  ")
+	if err != nil {
+		return err
+	}
+
+	f, err := modelsFile()
+	if err != nil {
+		return err
+	}
+	if err := os.MkdirAll(filepath.Dir(f), 0755); err != nil {
+		return err
+	}
+
+	// other instances may be saving at the same time.
+	tmp, err := os.CreateTemp(filepath.Dir(f), "timings-*.json")
+	if err != nil {
+		return err
+	}
+	defer os.Remove(tmp.Name())
+
+	if _, err := tmp.Write(data); err != nil {
+		tmp.Close()
+		return err
+	}
+	if err := tmp.Close(); err != nil {
+		return err
+	}
+	return os.Rename(tmp.Name(), f)
+}
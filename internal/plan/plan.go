@@ -0,0 +1,222 @@
+package plan
+
+import (
+	"cmp"
+	"errors"
+	"fmt"
+	"slices"
+
+	"rafaelmartins.com/p/iceflashprog/internal/device"
+)
+
+var ErrInvalidPlan = errors.New("iceflashprog: plan: invalid plan")
+
+type Verify byte
+
+const (
+	// VerifyPage reads back each page right after programming it.
+	VerifyPage Verify = iota
+
+	// VerifyRange compares a single CRC of the whole region at the end.
+	VerifyRange
+
+	// VerifyNone skips verification.
+	VerifyNone
+)
+
+func ParseVerify(s string) (Verify, error) {
+	switch s {
+	case "page":
+		return VerifyPage, nil
+	case "range":
+		return VerifyRange, nil
+	case "none":
+		return VerifyNone, nil
+	}
+	return 0, fmt.Errorf("invalid verify policy: %s", s)
+}
+
+// Region is a chunk of data to be programmed at a flash memory address.
+type Region struct {
+	Name    string
+	Address uint32
+	Data    []byte
+	Verify  Verify
+	Erase   bool
+}
+
+func (r *Region) end() uint32 {
+	return r.Address + uint32(len(r.Data))
+}
+
+// ForEachPage calls f for each flash page of the region, the last one may be
+// short.
+func (r *Region) ForEachPage(f func(addr uint32, data []byte) error) error {
+	for off := uint32(0); off < uint32(len(r.Data)); off += device.FlashPageSize {
+		if err := f(r.Address+off, r.Data[off:min(off+device.FlashPageSize, uint32(len(r.Data)))]); err != nil {
+			return err
+		}
+	}
+	return nil
+}
+
+// Step is a job step, with the region it programs or verifies.
+type Step struct {
+	device.JobStep
+	Region *Region
+}
+
+// Job is a sequence of steps that fits in a single device job.
+type Job []Step
+
+func (j Job) Steps() []device.JobStep {
+	rv := []device.JobStep{}
+	for _, step := range j {
+		rv = append(rv, step.JobStep)
+	}
+	return rv
+}
+
+// Length returns the amount of bytes processed by the job, as reported by
+// its progress.
+func (j Job) Length() uint32 {
+	rv := uint32(0)
+	for _, step := range j {
+		rv += step.Length
+	}
+	return rv
+}
+
+func alignDown(v uint32, a uint32) uint32 {
+	return v &^ (a - 1)
+}
+
+func alignUp(v uint32, a uint32) uint32 {
+	return alignDown(v+a-1, a)
+}
+
+// EraseSteps returns the job steps that erase every sector touched by the
+// given range, using block erases for the fully covered blocks and sector
+// erases for the edges.
+func EraseSteps(addr uint32, length uint32) []device.JobStep {
+	if length == 0 {
+		return nil
+	}
+
+	start := alignDown(addr, device.FlashSectorSize)
+	end := alignUp(addr+length, device.FlashSectorSize)
+
+	blockStart := alignUp(start, device.FlashBlockSize)
+	blockEnd := alignDown(end, device.FlashBlockSize)
+	if blockStart >= blockEnd {
+		return []device.JobStep{{Op: device.JobEraseSector, Address: start, Length: end - start}}
+	}
+
+	rv := []device.JobStep{}
+	if start < blockStart {
+		rv = append(rv, device.JobStep{Op: device.JobEraseSector, Address: start, Length: blockStart - start})
+	}
+	rv = append(rv, device.JobStep{Op: device.JobEraseBlock, Address: blockStart, Length: blockEnd - blockStart})
+	if blockEnd < end {
+		rv = append(rv, device.JobStep{Op: device.JobEraseSector, Address: blockEnd, Length: end - blockEnd})
+	}
+	return rv
+}
+
+// Build merges the regions into a single plan: all the erases first, with
+// touching or overlapping ranges merged, then programming and verification
+// in address order. The steps are split into as many jobs as needed.
+func Build(regions []Region) ([]Job, error) {
+	rs := []*Region{}
+	for i := range regions {
+		if len(regions[i].Data) > 0 {
+			rs = append(rs, &regions[i])
+		}
+	}
+	slices.SortFunc(rs, func(a *Region, b *Region) int {
+		return cmp.Compare(a.Address, b.Address)
+	})
+
+	for i, r := range rs {
+		if r.Address%device.FlashPageSize != 0 {
+			return nil, fmt.Errorf("%w: %s: address not aligned to flash page: %#x", ErrInvalidPlan, r.Name, r.Address)
+		}
+
+		// pages are programmed whole, padded with erased bytes.
+		if i > 0 && alignUp(rs[i-1].end(), device.FlashPageSize) > r.Address {
+			return nil, fmt.Errorf("%w: regions overlap: %s, %s", ErrInvalidPlan, rs[i-1].Name, r.Name)
+		}
+	}
+
+	// erasing a sector shared with a region that must not be erased would
+	// destroy its content.
+	for i, r := range rs {
+		for _, o := range rs[i+1:] {
+			if r.Erase == o.Erase {
+				continue
+			}
+			if alignUp(r.end(), device.FlashSectorSize) > alignDown(o.Address, device.FlashSectorSize) {
+				return nil, fmt.Errorf("%w: regions share an erase sector, but only one is erased: %s, %s", ErrInvalidPlan, r.Name, o.Name)
+			}
+		}
+	}
+
+	steps := []Step{}
+
+	var start, end uint32
+	for _, r := range rs {
+		if !r.Erase {
+			continue
+		}
+
+		rstart := alignDown(r.Address, device.FlashSectorSize)
+		if start != end && rstart <= end {
+			end = max(end, alignUp(r.end(), device.FlashSectorSize))
+			continue
+		}
+
+		for _, s := range EraseSteps(start, end-start) {
+			steps = append(steps, Step{JobStep: s})
+		}
+		start, end = rstart, alignUp(r.end(), device.FlashSectorSize)
+	}
+	for _, s := range EraseSteps(start, end-start) {
+		steps = append(steps, Step{JobStep: s})
+	}
+
+	for _, r := range rs {
+		op := device.JobProgram
+		if r.Verify != VerifyPage {
+			op = device.JobProgramNoVerify
+		}
+		steps = append(steps, Step{
+			JobStep: device.JobStep{
+				Op:      op,
+				Address: r.Address,
+				Length:  alignUp(uint32(len(r.Data)), device.FlashPageSize),
+			},
+			Region: r,
+		})
+	}
+
+	for _, r := range rs {
+		if r.Verify == VerifyRange {
+			steps = append(steps, Step{
+				JobStep: device.JobStep{
+					Op:      device.JobCRC,
+					Address: r.Address,
+					Length:  uint32(len(r.Data)),
+				},
+				Region: r,
+			})
+		}
+	}
+
+	rv := []Job{}
+	for len(steps) > 0 {
+		n := min(len(steps), device.JobMaxSteps)
+		rv = append(rv, Job(steps[:n]))
+		steps = steps[n:]
+	}
+	return rv, nil
+}
@@ -0,0 +1,86 @@
+package plan
+
+import (
+	"testing"
+
+	"rafaelmartins.com/p/iceflashprog/internal/device"
+)
+
+func TestEraseSteps(t *testing.T) {
+	for _, tc := range []struct {
+		addr, length uint32
+		steps        []device.JobStep
+	}{
+		{0, 0, nil},
+		{0x100, 0x10, []device.JobStep{
+			{Op: device.JobEraseSector, Address: 0, Length: device.FlashSectorSize},
+		}},
+		{0, device.FlashBlockSize, []device.JobStep{
+			{Op: device.JobEraseBlock, Address: 0, Length: device.FlashBlockSize},
+		}},
+		{device.FlashSectorSize, 2 * device.FlashBlockSize, []device.JobStep{
+			{Op: device.JobEraseSector, Address: device.FlashSectorSize, Length: device.FlashBlockSize - device.FlashSectorSize},
+			{Op: device.JobEraseBlock, Address: device.FlashBlockSize, Length: device.FlashBlockSize},
+			{Op: device.JobEraseSector, Address: 2 * device.FlashBlockSize, Length: device.FlashSectorSize},
+		}},
+	} {
+		steps := EraseSteps(tc.addr, tc.length)
+		if len(steps) != len(tc.steps) {
+			t.Fatalf("%#x+%#x: invalid steps: %+v", tc.addr, tc.length, steps)
+		}
+		for i, s := range steps {
+			if s != tc.steps[i] {
+				t.Fatalf("%#x+%#x: invalid step %d: %+v", tc.addr, tc.length, i, s)
+			}
+		}
+	}
+}
+
+func TestBuild(t *testing.T) {
+	regions := []Region{
+		{Name: "b", Address: device.FlashSectorSize, Data: make([]byte, 10), Verify: VerifyRange, Erase: true},
+		{Name: "a", Address: 0, Data: make([]byte, device.FlashPageSize+1), Verify: VerifyPage, Erase: true},
+	}
+
+	jobs, err := Build(regions)
+	if err != nil {
+		t.Fatal(err)
+	}
+	if len(jobs) != 1 {
+		t.Fatalf("invalid jobs: %d", len(jobs))
+	}
+
+	want := []device.JobStep{
+		{Op: device.JobEraseSector, Address: 0, Length: 2 * device.FlashSectorSize},
+		{Op: device.JobProgram, Address: 0, Length: 2 * device.FlashPageSize},
+		{Op: device.JobProgramNoVerify, Address: device.FlashSectorSize, Length: device.FlashPageSize},
+		{Op: device.JobCRC, Address: device.FlashSectorSize, Length: 10},
+	}
+	steps := jobs[0].Steps()
+	if len(steps) != len(want) {
+		t.Fatalf("invalid steps: %+v", steps)
+	}
+	for i, s := range steps {
+		if s != want[i] {
+			t.Fatalf("invalid step %d: %+v", i, s)
+		}
+	}
+}
+
+func TestBuildInvalid(t *testing.T) {
+	for _, regions := range [][]Region{
+		{{Name: "a", Address: 1, Data: []byte{1}}},
+		{
+			{Name: "a", Address: 0, Data: make([]byte, 10)},
+			{Name: "b", Address: 0, Data: make([]byte, 10)},
+		},
+		{
+			{Name: "a", Address: 0, Data: make([]byte, 10), Erase: true},
+			{Name: "b", Address: device.FlashPageSize, Data: make([]byte, 10)},
+		},
+	} {
+		if _, err := Build(regions); err == nil {
+			t.Fatalf("expected error: %+v", regions[0].Name)
+		}
+	}
+}
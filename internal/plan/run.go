@@ -0,0 +1,129 @@
+package plan
+
+import (
+	"hash/crc32"
+	"time"
+
+	"rafaelmartins.com/p/iceflashprog/internal/device"
+)
+
+// Run runs the job on the device, if supported by the firmware, and returns
+// the results of its CRC steps, and how long each step took on the device.
+// The progress callback is optional.
+func Run(dev *device.Device, job Job, progress func(done uint32)) ([]uint32, []time.Duration, error) {
+	if progress == nil {
+		progress = func(uint32) {}
+	}
+
+	caps := dev.Capabilities()
+	if !caps.Has(device.FeatureJobs) {
+		res, err := runOnHost(dev, job, progress)
+		return res, nil, err
+	}
+
+	steps := job.Steps()
+	for i := range steps {
+		if steps[i].Op == device.JobProgramNoVerify && !caps.Has(device.FeatureProgramNoVerify) {
+			steps[i].Op = device.JobProgram
+		}
+	}
+
+	// jobs run on the device without a host round trip per page, the host
+	// only feeds the pages of the program steps.
+	op, err := dev.RunJob(steps, progress)
+	if err != nil {
+		return nil, nil, err
+	}
+
+	for i, step := range job {
+		if step.Op != device.JobProgram && step.Op != device.JobProgramNoVerify {
+			continue
+		}
+
+		if err := op.WaitStep(i); err != nil {
+			return nil, nil, err
+		}
+
+		if err := step.Region.ForEachPage(func(addr uint32, data []byte) error {
+			select {
+			case <-op.Done():
+				return op.Wait()
+			default:
+			}
+			return dev.WriteJobPage(addr, data)
+		}); err != nil {
+			return nil, nil, err
+		}
+	}
+
+	if err := op.Wait(); err != nil {
+		return nil, nil, err
+	}
+	return op.Results(), op.StepDurations(), nil
+}
+
+// runOnHost runs the job steps as individual requests, for firmware without
+// jobs.
+func runOnHost(dev *device.Device, job Job, progress func(done uint32)) ([]uint32, error) {
+	done := uint32(0)
+	rv := []uint32{}
+
+	for _, step := range job {
+		switch step.Op {
+		case device.JobEraseSector, device.JobEraseBlock:
+			size, erase := uint32(device.FlashSectorSize), dev.EraseFlashSector
+			if step.Op == device.JobEraseBlock {
+				size, erase = device.FlashBlockSize, dev.EraseFlashBlock
+			}
+
+			for off := uint32(0); off < step.Length; off += size {
+				if err := erase(step.Address + off); err != nil {
+					return nil, err
+				}
+				done += size
+				progress(done)
+			}
+
+		case device.JobProgram, device.JobProgramNoVerify:
+			// pages written directly are always verified by the device.
+			if err := step.Region.ForEachPage(func(addr uint32, data []byte) error {
+				if err := dev.WriteFlashPage(addr, data); err != nil {
+					return err
+				}
+				done += device.FlashPageSize
+				progress(done)
+				return nil
+			}); err != nil {
+				return nil, err
+			}
+
+		case device.JobCRC:
+			crc, err := CRC(dev, step.Address, step.Length)
+			if err != nil {
+				return nil, err
+			}
+			rv = append(rv, crc)
+			done += step.Length
+			progress(done)
+		}
+	}
+	return rv, nil
+}
+
+// CRC returns the CRC-32 (IEEE) of a flash memory range, calculated by the
+// device if supported, or from the range read back otherwise.
+func CRC(dev *device.Device, addr uint32, length uint32) (uint32, error) {
+	if dev.Capabilities().Has(device.FeatureCRC) {
+		return dev.CRC(addr, length)
+	}
+
+	h := crc32.NewIEEE()
+	for off := uint32(0); off < length; off += device.FlashPageSize {
+		data, err := dev.ReadFlashPage(addr + off)
+		if err != nil {
+			return 0, err
+		}
+		h.Write(data[:min(device.FlashPageSize, length-off)])
+	}
+	return h.Sum32(), nil
+}
@@ -0,0 +1,191 @@
+package plan
+
+import (
+	"bytes"
+	"cmp"
+	"fmt"
+	"hash/crc32"
+	"slices"
+	"time"
+
+	"rafaelmartins.com/p/iceflashprog/internal/device"
+)
+
+var erasedSectorCRC = crc32.ChecksumIEEE(bytes.Repeat([]byte{0xff}, device.FlashSectorSize))
+
+// Strategy is a way to write a set of regions, with its estimated duration.
+type Strategy struct {
+	Name      string
+	Note      string
+	ChipErase bool
+	Jobs      []Job
+	Estimate  time.Duration
+}
+
+// Sectors returns the addresses of the erase sectors touched by the regions
+// that are erased, in order.
+func Sectors(regions []Region) []uint32 {
+	rv := []uint32{}
+	for _, r := range regions {
+		if !r.Erase || len(r.Data) == 0 {
+			continue
+		}
+		for addr := alignDown(r.Address, device.FlashSectorSize); addr < r.end(); addr += device.FlashSectorSize {
+			rv = append(rv, addr)
+		}
+	}
+	slices.Sort(rv)
+	return slices.Compact(rv)
+}
+
+// QueryCost returns the estimated time to read the CRC of n sectors.
+func (m *Model) QueryCost(n int) time.Duration {
+	jobs := (n + device.JobMaxSteps - 1) / device.JobMaxSteps
+	return time.Duration(jobs)*m.JobOverhead + time.Duration(n)*pages(device.FlashSectorSize)*m.CRCPage
+}
+
+// sectorImages returns the content each erased sector must have after
+// writing the regions, with the bytes not covered by any region erased.
+func sectorImages(regions []Region) map[uint32][]byte {
+	rv := map[uint32][]byte{}
+	for _, r := range regions {
+		if !r.Erase {
+			continue
+		}
+		for addr := alignDown(r.Address, device.FlashSectorSize); addr < r.end(); addr += device.FlashSectorSize {
+			img, ok := rv[addr]
+			if !ok {
+				img = bytes.Repeat([]byte{0xff}, device.FlashSectorSize)
+				rv[addr] = img
+			}
+
+			start, end := max(addr, r.Address), min(addr+device.FlashSectorSize, r.end())
+			copy(img[start-addr:], r.Data[start-r.Address:end-r.Address])
+		}
+	}
+	return rv
+}
+
+// Incremental returns the regions reduced to the sectors whose content
+// differs from the current one, given by the CRC of each erase sector.
+// Sectors that are already erased are programmed without erasing them
+// again. It also returns the number of sectors that must be written.
+func Incremental(regions []Region, current map[uint32]uint32) ([]Region, int) {
+	type action byte
+	const (
+		skip action = iota
+		program
+		rewrite
+	)
+
+	actions := map[uint32]action{}
+	changed := 0
+	for addr, img := range sectorImages(regions) {
+		crc, ok := current[addr]
+		switch {
+		case ok && crc == crc32.ChecksumIEEE(img):
+			actions[addr] = skip
+		case ok && crc == erasedSectorCRC:
+			actions[addr] = program
+			changed++
+		default:
+			actions[addr] = rewrite
+			changed++
+		}
+	}
+
+	rv := []Region{}
+	last := -1 // index of the region the last one was taken from
+	for i, r := range regions {
+		if !r.Erase {
+			rv = append(rv, r)
+			last = -1
+			continue
+		}
+
+		for addr := alignDown(r.Address, device.FlashSectorSize); addr < r.end(); addr += device.FlashSectorSize {
+			a := actions[addr]
+			if a == skip {
+				continue
+			}
+
+			start, end := max(addr, r.Address), min(addr+device.FlashSectorSize, r.end())
+
+			// contiguous sectors of a region with the same action are
+			// written by the same step.
+			// names are not unique, the same file may be written to several
+			// addresses.
+			if l := len(rv) - 1; last == i && rv[l].end() == start && rv[l].Erase == (a == rewrite) {
+				rv[l].Data = r.Data[rv[l].Address-r.Address : end-r.Address]
+				continue
+			}
+
+			rv = append(rv, Region{
+				Name:    r.Name,
+				Address: start,
+				Data:    r.Data[start-r.Address : end-r.Address],
+				Verify:  r.Verify,
+				Erase:   a == rewrite,
+			})
+			last = i
+		}
+	}
+	return rv, changed
+}
+
+// Candidates returns the strategies that can write the regions, fastest
+// first according to the model. The incremental strategy is only included
+// if the CRC of the current content of the erase sectors is known, and its
+// estimate includes the time it took to read them.
+func (m *Model) Candidates(regions []Region, flashSize uint32, current map[uint32]uint32) ([]*Strategy, error) {
+	jobs, err := Build(regions)
+	if err != nil {
+		return nil, err
+	}
+	sectors := Sectors(regions)
+
+	rv := []*Strategy{{
+		Name:     "full",
+		Note:     fmt.Sprintf("erase and write %d sectors", len(sectors)),
+		Jobs:     jobs,
+		Estimate: m.Estimate(jobs),
+	}}
+
+	// a chip erase is only safe if every sector would be erased anyway.
+	if len(sectors) > 0 && uint32(len(sectors))*device.FlashSectorSize == flashSize {
+		rs := slices.Clone(regions)
+		for i := range rs {
+			rs[i].Erase = false
+		}
+		jobs, err := Build(rs)
+		if err != nil {
+			return nil, err
+		}
+		rv = append(rv, &Strategy{
+			Name:      "chip-erase",
+			Note:      "erase the whole chip, then write",
+			ChipErase: true,
+			Jobs:      jobs,
+			Estimate:  m.ChipErase + m.Estimate(jobs),
+		})
+	}
+
+	if current != nil {
+		rs, changed := Incremental(regions, current)
+		jobs, err := Build(rs)
+		if err != nil {
+			return nil, err
+		}
+		rv = append(rv, &Strategy{
+			Name:     "incremental",
+			Note:     fmt.Sprintf("%d of %d sectors changed", changed, len(sectors)),
+			Jobs:     jobs,
+			Estimate: m.QueryCost(len(sectors)) + m.Estimate(jobs),
+		})
+	}
+
+	slices.SortStableFunc(rv, func(a *Strategy, b *Strategy) int {
+		return cmp.Compare(a.Estimate, b.Estimate)
+	})
+	return rv, nil
+}
@@ -0,0 +1,99 @@
+package plan
+
+import (
+	"bytes"
+	"hash/crc32"
+	"testing"
+
+	"rafaelmartins.com/p/iceflashprog/internal/device"
+)
+
+func sector(b byte) []byte {
+	return bytes.Repeat([]byte{b}, device.FlashSectorSize)
+}
+
+func TestIncremental(t *testing.T) {
+	data := append(append(sector(1), sector(2)...), sector(3)...)
+	regions := []Region{{Name: "a.bin", Address: 0, Data: data, Erase: true}}
+
+	current := map[uint32]uint32{
+		0:                          crc32.ChecksumIEEE(sector(1)),
+		device.FlashSectorSize:     erasedSectorCRC,
+		2 * device.FlashSectorSize: crc32.ChecksumIEEE(sector(4)),
+	}
+
+	rs, changed := Incremental(regions, current)
+	if changed != 2 {
+		t.Fatalf("invalid changed sectors: %d", changed)
+	}
+	if len(rs) != 2 {
+		t.Fatalf("invalid regions: %d", len(rs))
+	}
+	if rs[0].Address != device.FlashSectorSize || rs[0].Erase || !bytes.Equal(rs[0].Data, sector(2)) {
+		t.Fatalf("invalid program region: %#x %t", rs[0].Address, rs[0].Erase)
+	}
+	if rs[1].Address != 2*device.FlashSectorSize || !rs[1].Erase || !bytes.Equal(rs[1].Data, sector(3)) {
+		t.Fatalf("invalid rewrite region: %#x %t", rs[1].Address, rs[1].Erase)
+	}
+}
+
+func TestIncrementalMerge(t *testing.T) {
+	data := append(sector(1), sector(2)...)
+	regions := []Region{{Name: "a.bin", Address: device.FlashSectorSize, Data: data, Erase: true}}
+
+	rs, changed := Incremental(regions, map[uint32]uint32{})
+	if changed != 2 || len(rs) != 1 {
+		t.Fatalf("invalid regions: %d, changed %d", len(rs), changed)
+	}
+	if rs[0].Address != device.FlashSectorSize || !rs[0].Erase || !bytes.Equal(rs[0].Data, data) {
+		t.Fatalf("invalid merged region: %#x", rs[0].Address)
+	}
+}
+
+func TestIncrementalSameName(t *testing.T) {
+	// the same file written twice, back to back.
+	data := append(sector(1), sector(2)...)
+	regions := []Region{
+		{Name: "a.bin", Address: 0, Data: data, Erase: true},
+		{Name: "a.bin", Address: uint32(len(data)), Data: data, Erase: true},
+	}
+
+	rs, changed := Incremental(regions, map[uint32]uint32{})
+	if changed != 4 || len(rs) != 2 {
+		t.Fatalf("invalid regions: %d, changed %d", len(rs), changed)
+	}
+	for i, r := range rs {
+		if r.Address != uint32(i*len(data)) || !bytes.Equal(r.Data, data) {
+			t.Fatalf("invalid region %d: %#x, %d bytes", i, r.Address, len(r.Data))
+		}
+	}
+	if _, err := Build(rs); err != nil {
+		t.Fatal(err)
+	}
+}
+
+func TestCandidates(t *testing.T) {
+	data := append(sector(1), sector(2)...)
+	regions := []Region{{Name: "a.bin", Address: 0, Data: data, Erase: true}}
+	current := map[uint32]uint32{
+		0:                      crc32.ChecksumIEEE(sector(1)),
+		device.FlashSectorSize: crc32.ChecksumIEEE(sector(2)),
+	}
+
+	m := DefaultModel(uint32(len(data)))
+	ss, err := m.Candidates(regions, uint32(len(data)), current)
+	if err != nil {
+		t.Fatal(err)
+	}
+	if len(ss) != 3 {
+		t.Fatalf("invalid strategies: %d", len(ss))
+	}
+	if ss[0].Name != "incremental" || len(ss[0].Jobs) != 0 {
+		t.Fatalf("invalid fastest strategy: %s", ss[0].Name)
+	}
+	for i := 1; i < len(ss); i++ {
+		if ss[i].Estimate < ss[i-1].Estimate {
+			t.Fatalf("strategies not sorted: %s, %s", ss[i-1].Name, ss[i].Name)
+		}
+	}
+}
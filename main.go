@@ -1,91 +1,784 @@
 package main
 
 import (
+	"bytes"
 	"flag"
 	"fmt"
+	"hash/crc32"
+	"io"
 	"os"
 	"path/filepath"
 	"runtime/debug"
 	"slices"
+	"time"
 
 	"github.com/schollz/progressbar/v3"
 	"rafaelmartins.com/p/iceflashprog/internal/bitstream"
 	"rafaelmartins.com/p/iceflashprog/internal/cleanup"
 	"rafaelmartins.com/p/iceflashprog/internal/device"
+	"rafaelmartins.com/p/iceflashprog/internal/footer"
+	"rafaelmartins.com/p/iceflashprog/internal/identify"
+	"rafaelmartins.com/p/iceflashprog/internal/layout"
+	"rafaelmartins.com/p/iceflashprog/internal/manifest"
+	"rafaelmartins.com/p/iceflashprog/internal/plan"
 )
 
+// options are the flags that select what to do with a device. They are sent
+// as is to the server when running as a client.
+type options struct {
+	Check        bool     `json:"check"`
+	Detect       bool     `json:"detect"`
+	ChipErase    bool     `json:"chip_erase"`
+	DryRun       bool     `json:"dry_run"`
+	Footer       bool     `json:"footer"`
+	Identify     string   `json:"identify"`
+	Integrity    bool     `json:"integrity"`
+	Layout       string   `json:"layout"`
+	Manifest     string   `json:"manifest"`
+	Plan         bool     `json:"plan"`
+	SkipErase    bool     `json:"skip_erase"`
+	Read         bool     `json:"read"`
+	SerialNumber string   `json:"serial_number"`
+	Sparse       bool     `json:"sparse"`
+	Slot         string   `json:"slot"`
+	SRAM         bool     `json:"sram"`
+	Verify       string   `json:"verify"`
+	Args         []string `json:"args"`
+}
+
 var (
-	check        = flag.Bool("c", false, "compare file content against flash memory")
-	detect       = flag.Bool("d", false, "detect flash memory and exit")
-	chipErase    = flag.Bool("e", false, "erase whole flash memory and exit")
-	skipErase    = flag.Bool("n", false, "do not erase flash before writing")
-	read         = flag.Bool("r", false, "read flash memory to file")
-	serialNumber = flag.String("s", "", "device serial number")
-	version      = flag.Bool("V", false, "show version and exit")
+	opts      options
+	socket    = flag.String("socket", os.Getenv("ICEFLASHPROG_SOCKET"), "unix socket of a running `iceflashprog serve`, also read from ICEFLASHPROG_SOCKET")
+	version   = flag.Bool("V", false, "show version and exit")
+	watchFlag = flag.Bool("watch", false, "wait for devices to be connected and run the operation on each of them, in parallel")
 )
 
-func readToFile(dev *device.Device, f string) error {
-	if err := os.MkdirAll(filepath.Dir(f), 0777); err != nil {
+func (o *options) register(fs *flag.FlagSet) {
+	fs.BoolVar(&o.Check, "c", false, "compare file content against flash memory")
+	fs.BoolVar(&o.Detect, "d", false, "detect flash memory and exit")
+	fs.BoolVar(&o.ChipErase, "e", false, "erase whole flash memory and exit")
+	fs.BoolVar(&o.DryRun, "dry-run", false, "print the write strategies and their estimated time, without writing")
+	fs.BoolVar(&o.Footer, "footer", false, "write a footer with per-sector hashes after the bitstream, for -i")
+	fs.StringVar(&o.Identify, "identify", "", "identify which of the bitstreams in a directory is in flash memory, or the sectors that differ from the closest one")
+	fs.BoolVar(&o.Integrity, "i", false, "verify flash memory against the footer written with -footer, without the input file")
+	fs.StringVar(&o.Layout, "layout", "", "write the images of a multi-image layout spec file, with warmboot header")
+	fs.StringVar(&o.Manifest, "manifest", "", "write the files listed in a manifest file, as a single plan")
+	fs.BoolVar(&o.SkipErase, "n", false, "do not erase flash before writing")
+	fs.BoolVar(&o.Plan, "plan", false, "print the write strategies and their estimated time, then the actual time after writing")
+	fs.BoolVar(&o.Read, "r", false, "read flash memory to file")
+	fs.StringVar(&o.SerialNumber, "s", "", "device serial number")
+	fs.BoolVar(&o.Sparse, "sparse", false, "with -r, skip the erased regions and write a sparse dump, that can be written back")
+	fs.StringVar(&o.Slot, "slot", "", "with -layout, write only the named image and the warmboot header")
+	fs.BoolVar(&o.SRAM, "sram", false, "load bitstream directly into FPGA SRAM, without touching flash")
+	fs.StringVar(&o.Verify, "verify", "page", "verify policy for writes: page (read back each page), range (one CRC of the whole range) or none")
+}
+
+func (o *options) validate() error {
+	if _, err := plan.ParseVerify(o.Verify); err != nil {
 		return err
 	}
 
-	fp, err := os.Create(f)
+	if o.Slot != "" && o.Layout == "" {
+		return fmt.Errorf("-slot requires -layout")
+	}
+	if o.Layout != "" && o.Manifest != "" {
+		return fmt.Errorf("-layout and -manifest can't be used together")
+	}
+	if o.Sparse && !o.Read {
+		return fmt.Errorf("-sparse requires -r")
+	}
+	if o.Footer && (o.Layout != "" || o.Manifest != "" || o.SRAM) {
+		return fmt.Errorf("-footer requires a single bitstream written to flash")
+	}
+	return nil
+}
+
+// absPaths makes the file arguments absolute, so that they can be used by a
+// server running from another directory.
+func (o *options) absPaths() error {
+	for _, f := range []*string{&o.Identify, &o.Layout, &o.Manifest} {
+		if *f == "" {
+			continue
+		}
+		p, err := filepath.Abs(*f)
+		if err != nil {
+			return err
+		}
+		*f = p
+	}
+
+	for i, arg := range o.Args {
+		if arg == "-" {
+			continue
+		}
+		p, err := filepath.Abs(arg)
+		if err != nil {
+			return err
+		}
+		o.Args[i] = p
+	}
+	return nil
+}
+
+// session runs the operation selected by the options on an open device,
+// either from the command line or from a server client.
+type session struct {
+	options
+	dev    *device.Device
+	stdout io.Writer
+	stderr io.Writer
+
+	// timing model of the flash memory part, calibrated by each write.
+	jedec string
+	model *plan.Model
+}
+
+func (s *session) bar(max int64, desc string) *progressbar.ProgressBar {
+	return progressbar.NewOptions64(max,
+		progressbar.OptionSetDescription(desc),
+		progressbar.OptionSetWriter(s.stderr),
+		progressbar.OptionShowBytes(true),
+		progressbar.OptionShowTotalBytes(true),
+		progressbar.OptionSetWidth(10),
+		progressbar.OptionThrottle(65*time.Millisecond),
+		progressbar.OptionShowCount(),
+		progressbar.OptionOnCompletion(func() {
+			fmt.Fprint(s.stderr, "\n")
+		}),
+		progressbar.OptionSpinnerType(14),
+		progressbar.OptionFullWidth(),
+		progressbar.OptionSetRenderBlankState(true),
+	)
+}
+
+func (s *session) readToFile(f string) error {
+	w, err := bitstream.Create(f)
 	if err != nil {
 		return err
 	}
-	defer fp.Close()
+	defer w.Close()
 
-	bar := progressbar.DefaultBytes(device.FlashSize, "Reading")
+	size := s.dev.FlashSize()
+	bar := s.bar(int64(size), "Reading")
 
-	addr := uint32(0)
-	for addr <= device.FlashSize {
-		data, err := dev.ReadFlashPage(addr)
+	for addr := uint32(0); addr < size; addr += device.FlashPageSize {
+		data, err := s.dev.ReadFlashPage(addr)
 		if err != nil {
 			return err
 		}
 
 		bar.Add(len(data))
 
-		if _, err := fp.Write(data); err != nil {
+		if _, err := w.Write(data); err != nil {
 			return err
 		}
+	}
+	return w.Close()
+}
 
-		addr += device.FlashPageSize
+// blankSectors returns which sectors of the flash memory are erased, from
+// the CRC of each block and then of the sectors of the blocks that are not
+// erased, without reading them. Nothing is known to be erased if the device
+// can't calculate CRCs.
+func (s *session) blankSectors() ([]bool, error) {
+	size := s.dev.FlashSize()
+	rv := make([]bool, size/device.FlashSectorSize)
+
+	caps := s.dev.Capabilities()
+	if !caps.Has(device.FeatureJobs) || !caps.Has(device.FeatureCRC) {
+		return rv, nil
 	}
-	return nil
+
+	blocks := []device.JobStep{}
+	for addr := uint32(0); addr < size; addr += device.FlashBlockSize {
+		blocks = append(blocks, device.JobStep{Address: addr, Length: min(device.FlashBlockSize, size-addr)})
+	}
+	crcs, err := s.crcs(blocks, func(uint32) {})
+	if err != nil {
+		return nil, err
+	}
+
+	erasedBlock := crc32.ChecksumIEEE(bytes.Repeat([]byte{0xff}, device.FlashBlockSize))
+	erasedSector := crc32.ChecksumIEEE(bytes.Repeat([]byte{0xff}, device.FlashSectorSize))
+
+	sectors := []device.JobStep{}
+	for i, b := range blocks {
+		if b.Length == device.FlashBlockSize && crcs[i] == erasedBlock {
+			for addr := b.Address; addr < b.Address+b.Length; addr += device.FlashSectorSize {
+				rv[addr/device.FlashSectorSize] = true
+			}
+			continue
+		}
+		for addr := b.Address; addr < b.Address+b.Length; addr += device.FlashSectorSize {
+			sectors = append(sectors, device.JobStep{Address: addr, Length: device.FlashSectorSize})
+		}
+	}
+
+	crcs, err = s.crcs(sectors, func(uint32) {})
+	if err != nil {
+		return nil, err
+	}
+	for i, sec := range sectors {
+		rv[sec.Address/device.FlashSectorSize] = crcs[i] == erasedSector
+	}
+	return rv, nil
 }
 
-func writeToChip(dev *device.Device, bs *bitstream.Bitstream) error {
-	if !*skipErase {
-		blocks := bs.ListFlashBlocks()
-		bar := progressbar.DefaultBytes(int64(len(blocks)*device.FlashBlockSize), "Erasing")
+// readToSparseFile reads only the sectors that are not erased, and writes
+// their pages that are not blank to a sparse dump.
+func (s *session) readToSparseFile(f string) error {
+	blank, err := s.blankSectors()
+	if err != nil {
+		return err
+	}
+
+	total := 0
+	for _, b := range blank {
+		if !b {
+			total += device.FlashSectorSize
+		}
+	}
+
+	w, err := bitstream.CreateSparse(f, s.dev.FlashSize())
+	if err != nil {
+		return err
+	}
+	defer w.Close()
+
+	bar := s.bar(int64(total), "Reading")
+
+	erasedPage := bytes.Repeat([]byte{0xff}, device.FlashPageSize)
+	for i, b := range blank {
+		if b {
+			continue
+		}
 
-		for _, addr := range blocks {
-			if err := dev.EraseFlashBlock(addr); err != nil {
+		addr := uint32(i) * device.FlashSectorSize
+		for off := uint32(0); off < device.FlashSectorSize; off += device.FlashPageSize {
+			data, err := s.dev.ReadFlashPage(addr + off)
+			if err != nil {
 				return err
 			}
 
-			bar.Add(device.FlashBlockSize)
+			bar.Add(len(data))
+
+			if bytes.Equal(data, erasedPage) {
+				continue
+			}
+			if _, err := w.WriteAt(data, int64(addr+off)); err != nil {
+				return err
+			}
 		}
 	}
 
-	bar := progressbar.DefaultBytes(int64(bs.Size()), "Writing")
+	fmt.Fprintf(s.stderr, "Read %d KB of %d KB, the rest is erased\n", total/1024, s.dev.FlashSize()/1024)
+	return w.Close()
+}
 
-	return bs.ForEachFlashPage(func(addr uint32, data []byte) error {
-		if err := dev.WriteFlashPage(addr, data); err != nil {
+// verifyPolicy returns the verify policy selected by the options, already
+// validated.
+func (s *session) verifyPolicy() plan.Verify {
+	v, _ := plan.ParseVerify(s.Verify)
+	return v
+}
+
+// crcs returns the CRC-32 (IEEE) of each flash memory range, calculated by
+// the device if supported.
+func (s *session) crcs(ranges []device.JobStep, progress func(done uint32)) ([]uint32, error) {
+	rv := []uint32{}
+	base := uint32(0)
+	for len(ranges) > 0 {
+		job := plan.Job{}
+		for _, r := range ranges[:min(len(ranges), device.JobMaxSteps)] {
+			job = append(job, plan.Step{
+				JobStep: device.JobStep{
+					Op:      device.JobCRC,
+					Address: r.Address,
+					Length:  r.Length,
+				},
+			})
+		}
+		ranges = ranges[len(job):]
+
+		res, err := s.runJob(job, func(done uint32) {
+			progress(base + done)
+		})
+		if err != nil {
+			return nil, err
+		}
+		if len(res) != len(job) {
+			return nil, fmt.Errorf("iceflashprog: protocol: invalid number of job results: %d", len(res))
+		}
+		rv = append(rv, res...)
+		base += job.Length()
+	}
+	return rv, nil
+}
+
+// sectorCRCs returns the CRC of the current content of each sector.
+func (s *session) sectorCRCs(sectors []uint32) (map[uint32]uint32, error) {
+	ranges := []device.JobStep{}
+	for _, addr := range sectors {
+		ranges = append(ranges, device.JobStep{Address: addr, Length: device.FlashSectorSize})
+	}
+
+	res, err := s.crcs(ranges, func(uint32) {})
+	if err != nil {
+		return nil, err
+	}
+
+	rv := map[uint32]uint32{}
+	for i, addr := range sectors {
+		rv[addr] = res[i]
+	}
+	return rv, nil
+}
+
+// strategy returns the fastest way to write the regions, according to the
+// timing model. The current flash content is only compared if reading it is
+// cheap enough to pay off.
+func (s *session) strategy(regions []plan.Region) (*plan.Strategy, error) {
+	cands, err := s.model.Candidates(regions, s.dev.FlashSize(), nil)
+	if err != nil {
+		return nil, err
+	}
+
+	caps := s.dev.Capabilities()
+	sectors := plan.Sectors(regions)
+	if len(sectors) > 0 && caps.Has(device.FeatureJobs) && caps.Has(device.FeatureCRC) && s.model.QueryCost(len(sectors)) < cands[0].Estimate/4 {
+		current, err := s.sectorCRCs(sectors)
+		if err != nil {
+			return nil, err
+		}
+		cands, err = s.model.Candidates(regions, s.dev.FlashSize(), current)
+		if err != nil {
+			return nil, err
+		}
+	}
+
+	if s.Plan || s.DryRun {
+		fmt.Fprintln(s.stdout, "Strategies:")
+		for _, c := range cands {
+			fmt.Fprintf(s.stdout, "  %-12s %8s  %s\n", c.Name, c.Estimate.Round(10*time.Millisecond), c.Note)
+		}
+		fmt.Fprintf(s.stdout, "Selected: %s\n\n", cands[0].Name)
+	}
+	return cands[0], nil
+}
+
+// saveModel stores the timing model calibrated by the last write.
+func (s *session) saveModel() {
+	if err := plan.SaveModel(s.jedec, s.model); err != nil {
+		fmt.Fprintf(s.stderr, "warning: failed to save timing model: %s\n", err)
+	}
+}
+
+// writeRegions erases, programs and verifies the regions as a single plan,
+// so that erases are merged and no region erases another.
+func (s *session) writeRegions(regions []plan.Region) error {
+	for _, r := range regions {
+		if end := r.Address + uint32(len(r.Data)); end > s.dev.FlashSize() {
+			return fmt.Errorf("%s is larger than flash memory: %d > %d", r.Name, end, s.dev.FlashSize())
+		}
+	}
+
+	start := time.Now()
+
+	st, err := s.strategy(regions)
+	if err != nil {
+		return err
+	}
+	if s.DryRun {
+		return nil
+	}
+	defer s.saveModel()
+
+	if st.ChipErase {
+		if err := s.eraseChip(); err != nil {
+			return err
+		}
+	}
+
+	total := uint32(0)
+	for _, job := range st.Jobs {
+		total += job.Length()
+	}
+	bar := s.bar(int64(total), "Writing")
+
+	base := uint32(0)
+	for _, job := range st.Jobs {
+		res, err := s.runJob(job, func(done uint32) {
+			bar.Set64(int64(base + done))
+		})
+		if err != nil {
 			return err
 		}
 
+		for _, step := range job {
+			if step.Op != device.JobCRC {
+				continue
+			}
+			if len(res) == 0 || res[0] != crc32.ChecksumIEEE(step.Region.Data) {
+				return fmt.Errorf("mismatch: flash memory CRC differs from %s", step.Region.Name)
+			}
+			res = res[1:]
+		}
+
+		base += job.Length()
+	}
+	if err := bar.Finish(); err != nil {
+		return err
+	}
+
+	if s.Plan {
+		fmt.Fprintf(s.stdout, "Done in %s (estimated %s)\n", time.Since(start).Round(10*time.Millisecond), st.Estimate.Round(10*time.Millisecond))
+	}
+	return nil
+}
+
+// runJob runs the job, and calibrates the timing model with the duration
+// of its steps.
+func (s *session) runJob(job plan.Job, progress func(done uint32)) ([]uint32, error) {
+	res, durations, err := plan.Run(s.dev, job, progress)
+	if err != nil {
+		return nil, err
+	}
+	s.model.Calibrate(job, durations)
+	return res, nil
+}
+
+func (s *session) eraseChip() error {
+	fmt.Fprint(s.stdout, "Erasing chip ...")
+	op, err := s.dev.EraseChipAsync(func(elapsed time.Duration) {
+		fmt.Fprintf(s.stdout, "\rErasing chip ... %s", elapsed.Round(time.Second))
+	})
+	if err != nil {
+		return err
+	}
+	if err := op.Wait(); err != nil {
+		return err
+	}
+	fmt.Fprintf(s.stdout, "\rErasing chip ... %s\n", op.Elapsed())
+	s.model.CalibrateChipErase(op.Elapsed())
+	return nil
+}
+
+func (s *session) writeToChip(bs *bitstream.Bitstream) error {
+	if bs.IsStream() {
+		return s.writeStreamToChip(bs)
+	}
+	if bs.IsSparse() {
+		return s.writeSparseToChip(bs)
+	}
+
+	regions := []plan.Region{{
+		Name:    "bitstream",
+		Address: 0,
+		Data:    bs.Bytes(),
+		Verify:  s.verifyPolicy(),
+		Erase:   !s.SkipErase,
+	}}
+	if s.Footer {
+		regions = append(regions, plan.Region{
+			Name:    "footer",
+			Address: footer.Address(bs.Size()),
+			Data:    footer.New(0, bs.Bytes()).Bytes(),
+			Verify:  s.verifyPolicy(),
+			Erase:   !s.SkipErase,
+		})
+	}
+	return s.writeRegions(regions)
+}
+
+// writeSparseToChip writes the extents of a sparse dump as a single plan.
+// Blank pages are not programmed, and the sectors without extents are left
+// as they are.
+func (s *session) writeSparseToChip(bs *bitstream.Bitstream) error {
+	if s.Footer {
+		return fmt.Errorf("-footer can't be used with sparse dumps")
+	}
+
+	regions := []plan.Region{}
+	for _, e := range bs.Extents() {
+		regions = append(regions, plan.Region{
+			Name:    fmt.Sprintf("extent %#06x", e.Address),
+			Address: e.Address,
+			Data:    e.Data,
+			Verify:  s.verifyPolicy(),
+			Erase:   !s.SkipErase,
+		})
+	}
+	return s.writeRegions(regions)
+}
+
+// findFooter looks for a footer at the start of each erase sector, and
+// returns the first valid one.
+func (s *session) findFooter() (*footer.Footer, uint32, error) {
+	size := s.dev.FlashSize()
+	for addr := uint32(device.FlashSectorSize); addr < size; addr += device.FlashSectorSize {
+		page, err := s.dev.ReadFlashPage(addr)
+		if err != nil {
+			return nil, 0, err
+		}
+
+		l, err := footer.Len(page)
+		if err != nil || addr+uint32(l) > size {
+			continue
+		}
+
+		data := append([]byte(nil), page...)
+		for uint32(len(data)) < uint32(l) {
+			page, err := s.dev.ReadFlashPage(addr + uint32(len(data)))
+			if err != nil {
+				return nil, 0, err
+			}
+			data = append(data, page...)
+		}
+
+		// image data that happens to contain the magic is not a footer.
+		f, err := footer.Parse(data)
+		if err != nil || footer.Address(f.Address+f.Length) != addr {
+			continue
+		}
+		return f, addr, nil
+	}
+	return nil, 0, fmt.Errorf("no footer found in flash memory")
+}
+
+// verifyIntegrity compares the CRC of each sector of the image described by
+// the footer with the one recorded in it.
+func (s *session) verifyIntegrity() error {
+	f, addr, err := s.findFooter()
+	if err != nil {
+		return err
+	}
+	fmt.Fprintf(s.stdout, "Footer: %#06x\nImage: %d bytes at %#06x, CRC %#08x\n", addr, f.Length, f.Address, f.CRC)
+
+	ranges := []device.JobStep{}
+	for i := range f.Sectors {
+		a, l := f.Sector(i)
+		ranges = append(ranges, device.JobStep{Address: a, Length: l})
+	}
+
+	bar := s.bar(int64(f.Length), "Verifying")
+	crcs, err := s.crcs(ranges, func(done uint32) {
+		bar.Set64(int64(done))
+	})
+	if err != nil {
+		return err
+	}
+	if err := bar.Finish(); err != nil {
+		return err
+	}
+
+	bad := 0
+	for i, crc := range crcs {
+		if crc != f.Sectors[i] {
+			fmt.Fprintf(s.stdout, "Sector %#06x differs\n", ranges[i].Address)
+			bad++
+		}
+	}
+	if bad > 0 {
+		return fmt.Errorf("mismatch: %d of %d sectors differ from footer", bad, len(crcs))
+	}
+	return nil
+}
+
+func (s *session) writeLayoutToChip(l *layout.Layout) error {
+	names := []string{}
+	if s.Slot != "" {
+		names = append(names, s.Slot)
+	}
+
+	regions, err := l.Regions(names...)
+	if err != nil {
+		return err
+	}
+
+	for i := range regions {
+		regions[i].Verify = s.verifyPolicy()
+		regions[i].Erase = !s.SkipErase
+	}
+	return s.writeRegions(regions)
+}
+
+func (s *session) writeStreamToChip(bs *bitstream.Bitstream) error {
+	if s.DryRun {
+		return fmt.Errorf("-dry-run can't plan a write from a stream")
+	}
+
+	bar := s.bar(-1, "Writing")
+
+	var fw *footer.Writer
+	if s.Footer {
+		fw = footer.NewWriter(0)
+	}
+
+	// each block is erased right before its first page. the flash memory
+	// can't program while erasing, but the input is still read in the
+	// background meanwhile.
+	erased := uint32(0)
+
+	if err := bs.ForEachFlashPage(func(addr uint32, data []byte) error {
+		if fw != nil {
+			fw.Write(data)
+		}
+
+		if !s.SkipErase && addr >= erased {
+			if err := s.dev.EraseFlashBlock(addr); err != nil {
+				return err
+			}
+			erased = addr + device.FlashBlockSize
+		}
+
+		if err := s.dev.WriteFlashPage(addr, data); err != nil {
+			return err
+		}
 		bar.Add(len(data))
 		return nil
+	}); err != nil {
+		return err
+	}
+
+	if fw != nil {
+		if err := s.writeStreamFooter(fw.Footer(), erased); err != nil {
+			return err
+		}
+	}
+
+	// pages written directly are always verified by the device, the stream
+	// can't be read again to check the whole range against it.
+	if s.verifyPolicy() != plan.VerifyRange {
+		return nil
+	}
+
+	fmt.Fprint(s.stdout, "Verifying ...")
+	crc, err := plan.CRC(s.dev, 0, bs.Size())
+	if err != nil {
+		return err
+	}
+	fmt.Fprintln(s.stdout, " done")
+
+	if crc != bs.Sum() {
+		return fmt.Errorf("mismatch: flash memory content differs from input stream")
+	}
+	return nil
+}
+
+// writeStreamFooter writes the footer after a streamed image, erasing the
+// sectors not erased with the image blocks.
+func (s *session) writeStreamFooter(f *footer.Footer, erased uint32) error {
+	addr := footer.Address(f.Address + f.Length)
+	data := f.Bytes()
+	if addr+uint32(len(data)) > s.dev.FlashSize() {
+		return fmt.Errorf("footer is larger than flash memory: %d > %d", addr+uint32(len(data)), s.dev.FlashSize())
+	}
+
+	for sector := addr; sector < addr+uint32(len(data)); sector += device.FlashSectorSize {
+		if !s.SkipErase && sector >= erased {
+			if err := s.dev.EraseFlashSector(sector); err != nil {
+				return err
+			}
+		}
+	}
+
+	r := plan.Region{Address: addr, Data: data}
+	return r.ForEachPage(s.dev.WriteFlashPage)
+}
+
+// identifyImage finds which of the known images is in flash memory, from the
+// CRC of as few sectors as possible, and confirms it with the CRC of the
+// whole image.
+func (s *session) identifyImage(images []*identify.Image) error {
+	res, err := identify.Identify(images, func(idx int) (uint32, error) {
+		crcs, err := s.crcs([]device.JobStep{{Address: uint32(idx) * device.FlashSectorSize, Length: device.FlashSectorSize}}, func(uint32) {})
+		if err != nil {
+			return 0, err
+		}
+		return crcs[0], nil
 	})
+	if err != nil {
+		return err
+	}
+
+	queries := res.Queries
+	for _, img := range res.Matches {
+		if img.Size > s.dev.FlashSize() {
+			continue
+		}
+
+		queries++
+		crcs, err := s.crcs([]device.JobStep{{Address: 0, Length: img.Size}}, func(uint32) {})
+		if err != nil {
+			return err
+		}
+		if crcs[0] == img.CRC {
+			fmt.Fprintf(s.stdout, "Identified: %s (%d bytes, CRC %#08x, %d queries)\n", img.Name, img.Size, img.CRC, queries)
+			return nil
+		}
+	}
+
+	img := res.Closest
+	fmt.Fprintf(s.stdout, "No known image matches, closest: %s\n", img.Name)
+
+	ranges := []device.JobStep{}
+	for i := range img.Sectors {
+		addr := uint32(i) * device.FlashSectorSize
+		if addr >= s.dev.FlashSize() {
+			break
+		}
+		ranges = append(ranges, device.JobStep{Address: addr, Length: device.FlashSectorSize})
+	}
+
+	crcs, err := s.crcs(ranges, func(uint32) {})
+	if err != nil {
+		return err
+	}
+
+	bad := len(img.Sectors) - len(crcs)
+	for i, crc := range crcs {
+		if crc != img.Sectors[i] {
+			fmt.Fprintf(s.stdout, "Sector %#06x differs\n", ranges[i].Address)
+			bad++
+		}
+	}
+	return fmt.Errorf("mismatch: %d of %d sectors differ from %s", bad, len(img.Sectors), img.Name)
 }
 
-func checkFile(dev *device.Device, bs *bitstream.Bitstream) error {
-	bar := progressbar.DefaultBytes(int64(bs.Size()), "Checking")
+func (s *session) writeToSRAM(bs *bitstream.Bitstream) error {
+	if err := s.dev.SRAMStart(); err != nil {
+		return err
+	}
+
+	size := int64(bs.Size())
+	if bs.IsStream() {
+		size = -1
+	}
+	bar := s.bar(size, "Configuring")
+
+	if err := bs.ForEachFlashPage(func(addr uint32, data []byte) error {
+		if err := s.dev.WriteSRAMPage(data); err != nil {
+			return err
+		}
+
+		bar.Add(len(data))
+		return nil
+	}); err != nil {
+		return err
+	}
+
+	return s.dev.SRAMFinish()
+}
+
+func (s *session) checkFile(bs *bitstream.Bitstream) error {
+	size := int64(bs.Size())
+	if bs.IsStream() {
+		size = -1
+	}
+	bar := s.bar(size, "Checking")
 
 	return bs.ForEachFlashPage(func(addr uint32, data []byte) error {
-		mdata, err := dev.ReadFlashPage(addr)
+		mdata, err := s.dev.ReadFlashPage(addr)
 		if err != nil {
 			return err
 		}
@@ -99,71 +792,201 @@ func checkFile(dev *device.Device, bs *bitstream.Bitstream) error {
 	})
 }
 
-func main() {
-	defer cleanup.Cleanup()
+func (s *session) run() error {
+	var lay *layout.Layout
+	if s.Layout != "" {
+		var err error
+		lay, err = layout.Parse(s.Layout)
+		if err != nil {
+			return err
+		}
+		if s.Slot != "" && lay.Image(s.Slot) == nil {
+			return fmt.Errorf("image not found in layout: %s", s.Slot)
+		}
+	}
 
-	flag.Parse()
+	var images []*identify.Image
+	if s.Identify != "" {
+		var err error
+		images, err = identify.Load(s.Identify)
+		if err != nil {
+			return err
+		}
+	}
 
-	if *version {
-		if bi, ok := debug.ReadBuildInfo(); ok {
-			fmt.Println(bi.Main.Version)
-			return
+	var regions []plan.Region
+	if s.Manifest != "" {
+		var err error
+		regions, err = manifest.Parse(s.Manifest, s.verifyPolicy(), !s.SkipErase)
+		if err != nil {
+			return err
 		}
 
-		fmt.Println("UNKNOWN")
-		cleanup.Exit(1)
+		// check for overlaps before touching the device.
+		if _, err := plan.Build(regions); err != nil {
+			return err
+		}
 	}
 
-	dev, err := device.New(*serialNumber)
+	caps, err := s.dev.GetCapabilities()
 	if err != nil {
-		cleanup.Check(err)
+		return err
 	}
-	cleanup.Check(err)
 
-	cleanup.Check(dev.Open())
-	cleanup.Register(dev)
+	if err := s.dev.PowerUp(); err != nil {
+		return err
+	}
 
-	go func() {
-		cleanup.Check(dev.Listen())
-	}()
+	mfr, devid, err := s.dev.GetJedecId()
+	if err != nil {
+		return err
+	}
 
-	cleanup.Check(dev.PowerUp())
+	fmt.Fprintf(s.stdout, "Manufacturer: %#02x\nDevice ID: %#04x\nSize: %d KB\n", mfr, devid, s.dev.FlashSize()/1024)
 
-	mfr, devid, err := dev.GetJedecId()
-	cleanup.Check(err)
+	s.jedec = fmt.Sprintf("%02x%04x", mfr, devid)
+	s.model = plan.LoadModel(s.jedec, s.dev.FlashSize())
+
+	if s.Detect {
+		fmt.Fprintf(s.stdout, "Protocol: %d\n", caps.Version)
+		if caps.SPIClock != 0 {
+			fmt.Fprintf(s.stdout, "SPI clock: %d kHz\n", caps.SPIClock/1000)
+		}
+		if caps.BuildOptions&device.BuildOptionSchedStats != 0 {
+			latency, run, err := s.dev.GetSchedulerStats()
+			if err != nil {
+				return err
+			}
+			fmt.Fprintf(s.stdout, "Worst-case USB latency: %s\nLongest task step: %s\n", latency, run)
+		}
+		return nil
+	}
 
-	fmt.Printf("Manufacturer: %#02x\nDevice ID: %#04x\n", mfr, devid)
+	fmt.Fprintln(s.stdout)
 
-	if *detect {
-		return
+	if s.ChipErase {
+		defer s.saveModel()
+		if err := s.eraseChip(); err != nil {
+			return err
+		}
+		fmt.Fprintln(s.stdout, "Done!")
+		return nil
 	}
 
-	fmt.Println()
+	if images != nil {
+		if len(s.Args) != 0 {
+			return fmt.Errorf("invalid arguments")
+		}
+		return s.identifyImage(images)
+	}
 
-	if *chipErase {
-		fmt.Println("Erasing chip ...")
-		cleanup.Check(dev.EraseChip())
-		fmt.Println("Done!")
-		return
+	if s.Integrity {
+		if len(s.Args) != 0 {
+			return fmt.Errorf("invalid arguments")
+		}
+		return s.verifyIntegrity()
 	}
 
-	if len(flag.Args()) != 1 {
-		cleanup.Check("invalid arguments")
+	if regions != nil {
+		if len(s.Args) != 0 {
+			return fmt.Errorf("invalid arguments")
+		}
+		return s.writeRegions(regions)
 	}
 
-	if *read {
-		cleanup.Check(readToFile(dev, flag.Arg(0)))
+	if lay != nil {
+		if len(s.Args) != 0 {
+			return fmt.Errorf("invalid arguments")
+		}
+		if lay.Size() > s.dev.FlashSize() {
+			return fmt.Errorf("layout is larger than flash memory: %d > %d", lay.Size(), s.dev.FlashSize())
+		}
+		return s.writeLayoutToChip(lay)
+	}
+
+	if len(s.Args) != 1 {
+		return fmt.Errorf("invalid arguments")
+	}
+
+	if s.Read {
+		if s.Sparse {
+			return s.readToSparseFile(s.Args[0])
+		}
+		return s.readToFile(s.Args[0])
+	}
+
+	bs, err := bitstream.New(s.Args[0])
+	if err != nil {
+		return err
+	}
+	defer bs.Close()
+
+	if bs.IsSparse() && bs.Size() > s.dev.FlashSize() {
+		return fmt.Errorf("sparse dump is larger than flash memory: %d > %d", bs.Size(), s.dev.FlashSize())
+	}
+
+	if s.Check {
+		return s.checkFile(bs)
+	}
+
+	if s.SRAM {
+		return s.writeToSRAM(bs)
+	}
+
+	return s.writeToChip(bs)
+}
+
+func main() {
+	defer cleanup.Cleanup()
+
+	opts.register(flag.CommandLine)
+	flag.Parse()
+
+	if *version {
+		if bi, ok := debug.ReadBuildInfo(); ok {
+			fmt.Println(bi.Main.Version)
+			return
+		}
+
+		fmt.Println("UNKNOWN")
+		cleanup.Exit(1)
+	}
+
+	if flag.Arg(0) == "serve" {
+		cleanup.Check(serve(flag.Args()[1:]))
 		return
 	}
 
-	bs, err := bitstream.New(flag.Arg(0))
-	cleanup.Check(err)
-	cleanup.Register(bs)
+	opts.Args = flag.Args()
+	cleanup.Check(opts.validate())
 
-	if *check {
-		cleanup.Check(checkFile(dev, bs))
+	if *watchFlag {
+		cleanup.Check(watch(&opts))
 		return
 	}
 
-	cleanup.Check(writeToChip(dev, bs))
+	conn, err := dialServer()
+	cleanup.Check(err)
+	if conn != nil {
+		cleanup.Check(runClient(conn, &opts))
+		return
+	}
+
+	dev, err := device.New(opts.SerialNumber)
+	cleanup.Check(err)
+
+	cleanup.Check(dev.Open())
+	cleanup.Register(dev)
+
+	go func() {
+		cleanup.Check(dev.Listen())
+	}()
+
+	s := &session{
+		options: opts,
+		dev:     dev,
+		stdout:  os.Stdout,
+		stderr:  os.Stderr,
+	}
+	cleanup.Check(s.run())
 }
@@ -0,0 +1,376 @@
+package main
+
+import (
+	"encoding/json"
+	"errors"
+	"flag"
+	"fmt"
+	"io"
+	"log"
+	"net"
+	"os"
+	"path/filepath"
+	"slices"
+	"sync"
+
+	"rafaelmartins.com/p/iceflashprog/internal/cleanup"
+	"rafaelmartins.com/p/iceflashprog/internal/device"
+	"rafaelmartins.com/p/iceflashprog/internal/hotplug"
+)
+
+// jobQueueSize is the number of requests that can wait for a busy device
+// before new clients block.
+const jobQueueSize = 16
+
+var errDisconnected = errors.New("iceflashprog: device disconnected")
+
+// frame is a message from the server to a client: output to be written to
+// the client's stdout/stderr, or the final result of its request.
+type frame struct {
+	Stdout string `json:"stdout,omitempty"`
+	Stderr string `json:"stderr,omitempty"`
+	Done   bool   `json:"done,omitempty"`
+	Error  string `json:"error,omitempty"`
+}
+
+type frameWriter struct {
+	m      *sync.Mutex
+	enc    *json.Encoder
+	stderr bool
+}
+
+func (w *frameWriter) Write(p []byte) (int, error) {
+	w.m.Lock()
+	defer w.m.Unlock()
+
+	f := frame{Stdout: string(p)}
+	if w.stderr {
+		f = frame{Stderr: string(p)}
+	}
+
+	// a client that went away must not abort the operation on the device.
+	w.enc.Encode(f)
+	return len(p), nil
+}
+
+func defaultSocket() string {
+	dir := os.Getenv("XDG_RUNTIME_DIR")
+	if dir == "" {
+		dir = os.TempDir()
+	}
+	return filepath.Join(dir, "iceflashprog.sock")
+}
+
+type job struct {
+	opts   options
+	stdout io.Writer
+	stderr io.Writer
+	done   chan error
+}
+
+type worker struct {
+	dev  *device.Device
+	jobs chan *job
+
+	// gone is closed when the device is removed, and stopped once the
+	// worker won't run any other job.
+	gone    chan struct{}
+	stopped chan struct{}
+	once    sync.Once
+}
+
+func (w *worker) close() {
+	w.once.Do(func() {
+		close(w.gone)
+		w.dev.Close()
+	})
+}
+
+type server struct {
+	hold bool
+
+	m       sync.Mutex
+	workers map[string]*worker
+	seen    map[string]bool
+}
+
+func (s *server) open(dev *device.Device) error {
+	if err := dev.Open(); err != nil {
+		return err
+	}
+
+	sn := dev.SerialNumber()
+	w := &worker{
+		dev:     dev,
+		jobs:    make(chan *job, jobQueueSize),
+		gone:    make(chan struct{}),
+		stopped: make(chan struct{}),
+	}
+
+	s.m.Lock()
+	s.workers[sn] = w
+	s.m.Unlock()
+
+	go func() {
+		if err := dev.Listen(); err != nil {
+			log.Printf("device %q: %s", sn, err)
+		}
+		s.remove(sn, w)
+	}()
+
+	if s.hold {
+		if err := dev.PowerUp(); err != nil {
+			log.Printf("device %q: %s", sn, err)
+		}
+	}
+
+	go s.work(w)
+
+	log.Printf("device %q: ready", sn)
+	return nil
+}
+
+// remove closes the device of a worker and stops it, once disconnected.
+func (s *server) remove(sn string, w *worker) {
+	s.m.Lock()
+	removed := s.workers[sn] == w
+	if removed {
+		delete(s.workers, sn)
+	}
+	s.m.Unlock()
+
+	w.close()
+	if removed {
+		log.Printf("device %q: removed", sn)
+	}
+}
+
+// scan opens the devices connected since the last scan, and removes the
+// workers of the devices disconnected.
+func (s *server) scan() {
+	devices, err := device.List()
+	if err != nil {
+		log.Printf("error: %s", err)
+		return
+	}
+
+	present := map[string]bool{}
+	for _, dev := range devices {
+		path := dev.Path()
+		present[path] = true
+
+		// devices that failed to open are tried again when connected back.
+		s.m.Lock()
+		seen := s.seen[path]
+		s.seen[path] = true
+		s.m.Unlock()
+		if seen {
+			continue
+		}
+
+		if err := s.open(dev); err != nil {
+			log.Printf("device %q: %s", dev.SerialNumber(), err)
+		}
+	}
+
+	s.m.Lock()
+	for path := range s.seen {
+		if !present[path] {
+			delete(s.seen, path)
+		}
+	}
+	gone := map[string]*worker{}
+	for sn, w := range s.workers {
+		if !present[w.dev.Path()] {
+			gone[sn] = w
+		}
+	}
+	s.m.Unlock()
+
+	for sn, w := range gone {
+		s.remove(sn, w)
+	}
+}
+
+func (s *server) work(w *worker) {
+	defer close(w.stopped)
+
+	for {
+		var j *job
+		select {
+		case j = <-w.jobs:
+		case <-w.gone:
+			return
+		}
+
+		sess := &session{
+			options: j.opts,
+			dev:     w.dev,
+			stdout:  j.stdout,
+			stderr:  j.stderr,
+		}
+		err := sess.run()
+
+		// releasing the power lets the FPGA configure itself from the new
+		// flash content, as when the command line tool exits.
+		if !s.hold {
+			if perr := w.dev.PowerDown(); err == nil {
+				err = perr
+			}
+		}
+		j.done <- err
+	}
+}
+
+func (s *server) worker(sn string) (*worker, error) {
+	s.m.Lock()
+	defer s.m.Unlock()
+
+	if sn != "" {
+		w, ok := s.workers[sn]
+		if !ok {
+			return nil, fmt.Errorf("iceflashprog: device not found: %q", sn)
+		}
+		return w, nil
+	}
+
+	if len(s.workers) == 1 {
+		for _, w := range s.workers {
+			return w, nil
+		}
+	}
+
+	if len(s.workers) == 0 {
+		return nil, errors.New("iceflashprog: no device found")
+	}
+
+	sns := []string{}
+	for sn := range s.workers {
+		sns = append(sns, sn)
+	}
+	return nil, fmt.Errorf("iceflashprog: more than one device found %q", sns)
+}
+
+func (s *server) handle(conn net.Conn) {
+	defer conn.Close()
+
+	m := &sync.Mutex{}
+	enc := json.NewEncoder(conn)
+	done := func(err error) {
+		f := frame{Done: true}
+		if err != nil {
+			f.Error = err.Error()
+		}
+
+		m.Lock()
+		defer m.Unlock()
+		enc.Encode(f)
+	}
+
+	j := &job{
+		stdout: &frameWriter{m: m, enc: enc},
+		stderr: &frameWriter{m: m, enc: enc, stderr: true},
+		done:   make(chan error, 1),
+	}
+
+	if err := json.NewDecoder(conn).Decode(&j.opts); err != nil {
+		done(err)
+		return
+	}
+	if err := j.opts.validate(); err != nil {
+		done(err)
+		return
+	}
+	if slices.Contains(j.opts.Args, "-") {
+		done(errors.New("standard input is not supported by the server"))
+		return
+	}
+
+	w, err := s.worker(j.opts.SerialNumber)
+	if err != nil {
+		done(err)
+		return
+	}
+
+	select {
+	case w.jobs <- j:
+	case <-w.gone:
+		done(errDisconnected)
+		return
+	}
+
+	// a job already running when the device is removed still completes,
+	// with the error of the closed device.
+	select {
+	case err := <-j.done:
+		done(err)
+	case <-w.stopped:
+		select {
+		case err := <-j.done:
+			done(err)
+		default:
+			done(errDisconnected)
+		}
+	}
+}
+
+func (s *server) Close() error {
+	s.m.Lock()
+	defer s.m.Unlock()
+
+	for _, w := range s.workers {
+		w.close()
+	}
+	s.workers = map[string]*worker{}
+	return nil
+}
+
+func serve(args []string) error {
+	fs := flag.NewFlagSet("serve", flag.ExitOnError)
+	hold := fs.Bool("hold", false, "keep the flash memory powered and the FPGA held in reset between requests")
+	fs.Parse(args)
+
+	sock := *socket
+	if sock == "" {
+		sock = defaultSocket()
+	}
+
+	if conn, err := net.Dial("unix", sock); err == nil {
+		conn.Close()
+		return fmt.Errorf("server already running: %s", sock)
+	}
+	os.Remove(sock)
+
+	ln, err := net.Listen("unix", sock)
+	if err != nil {
+		return err
+	}
+	cleanup.Register(ln)
+
+	s := &server{
+		hold:    *hold,
+		workers: map[string]*worker{},
+		seen:    map[string]bool{},
+	}
+	cleanup.Register(s)
+
+	// the devices already connected are opened before accepting requests.
+	events := hotplug.Watch()
+	<-events
+	s.scan()
+	go func() {
+		for range events {
+			s.scan()
+		}
+	}()
+
+	log.Printf("listening on %s", sock)
+
+	for {
+		conn, err := ln.Accept()
+		if err != nil {
+			return err
+		}
+		go s.handle(conn)
+	}
+}
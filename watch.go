@@ -0,0 +1,149 @@
+package main
+
+import (
+	"fmt"
+	"io"
+	"log"
+	"path/filepath"
+	"strings"
+	"sync"
+	"time"
+
+	"rafaelmartins.com/p/iceflashprog/internal/bitstream"
+	"rafaelmartins.com/p/iceflashprog/internal/device"
+	"rafaelmartins.com/p/iceflashprog/internal/hotplug"
+	"rafaelmartins.com/p/iceflashprog/internal/layout"
+	"rafaelmartins.com/p/iceflashprog/internal/manifest"
+	"rafaelmartins.com/p/iceflashprog/internal/plan"
+)
+
+type watcher struct {
+	opts options
+
+	m    sync.Mutex
+	seen map[string]bool
+}
+
+// deviceFile returns the file name used for the dump of a device, with its
+// serial number added before the extension.
+func deviceFile(file string, sn string) string {
+	ext := filepath.Ext(file)
+	return strings.TrimSuffix(file, ext) + "-" + sn + ext
+}
+
+func (w *watcher) run(dev *device.Device) error {
+	opts := w.opts
+
+	// every device dumps to its own file.
+	if opts.Read {
+		sn := dev.SerialNumber()
+		if sn == "" || strings.ContainsAny(sn, `/\`) {
+			return fmt.Errorf("invalid serial number for the dump file name: %q", sn)
+		}
+		opts.Args = []string{deviceFile(opts.Args[0], sn)}
+	}
+
+	if err := dev.Open(); err != nil {
+		return err
+	}
+	defer dev.Close()
+
+	go func() {
+		if err := dev.Listen(); err != nil {
+			log.Printf("device %q: %s", dev.SerialNumber(), err)
+		}
+	}()
+
+	// progress bars of parallel devices would be garbled, only the result
+	// of each device is logged.
+	s := &session{
+		options: opts,
+		dev:     dev,
+		stdout:  io.Discard,
+		stderr:  io.Discard,
+	}
+	return s.run()
+}
+
+func (w *watcher) scan() {
+	devices, err := device.List()
+	if err != nil {
+		log.Printf("error: %s", err)
+		return
+	}
+
+	w.m.Lock()
+	defer w.m.Unlock()
+
+	present := map[string]bool{}
+	for _, dev := range devices {
+		path := dev.Path()
+		present[path] = true
+		if w.seen[path] {
+			continue
+		}
+		w.seen[path] = true
+
+		go func(dev *device.Device) {
+			sn := dev.SerialNumber()
+			log.Printf("device %q: started", sn)
+
+			start := time.Now()
+			if err := w.run(dev); err != nil {
+				log.Printf("device %q: failed: %s", sn, err)
+				return
+			}
+			log.Printf("device %q: done in %s", sn, time.Since(start).Round(time.Millisecond))
+		}(dev)
+	}
+
+	// disconnected devices are handled again when connected back.
+	for path := range w.seen {
+		if !present[path] {
+			delete(w.seen, path)
+		}
+	}
+}
+
+// watch runs the operation selected by the options on every device
+// connected, as soon as it is detected, in parallel.
+func watch(o *options) error {
+	if o.SerialNumber != "" {
+		return fmt.Errorf("-watch can't be used with -s")
+	}
+
+	// fail early for bad inputs, instead of once per device.
+	if o.Read && len(o.Args) != 1 {
+		return fmt.Errorf("invalid arguments")
+	}
+	if o.Layout != "" {
+		if _, err := layout.Parse(o.Layout); err != nil {
+			return err
+		}
+	} else if o.Manifest != "" {
+		if _, err := manifest.Parse(o.Manifest, plan.VerifyNone, false); err != nil {
+			return err
+		}
+	} else if len(o.Args) == 1 && !o.Read {
+		bs, err := bitstream.New(o.Args[0])
+		if err != nil {
+			return err
+		}
+		stream := bs.IsStream()
+		bs.Close()
+		if stream {
+			return fmt.Errorf("-watch requires a regular file")
+		}
+	}
+
+	w := &watcher{
+		opts: *o,
+		seen: map[string]bool{},
+	}
+
+	log.Printf("waiting for devices")
+	for range hotplug.Watch() {
+		w.scan()
+	}
+	return nil
+}